@@ -1,5 +1,10 @@
-#include <deque>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
 #include <string>
 #include <variant>
 #include <vector>
@@ -12,175 +17,528 @@
 
 #include "input.hpp"
 
-std::vector<std::deque<char>>
-process_start_stack(const std::vector<std::string> &in) {
-  std::vector<std::string> stacks(in.begin(), in.begin() + 8);
-
-  auto cleaned_stacks = stacks | ranges::views::transform([](auto x) {
-                          // every 4 elements there is a new part of the stack
-                          return x | ranges::views::chunk(4) |
-                                 ranges::views::transform([](auto y) {
-                                   // Remove all brackets and whitespace
-                                   return y | ranges::views::filter([](auto c) {
-                                            return std::isalpha(c);
-                                          }) |
-                                          ranges::to<std::vector>;
-                                 }) |
-                                 // Replace empty ranges with a placeholder,
-                                 // else just return the single element left
-                                 ranges::views::transform([](auto x) {
-                                   if (ranges::empty(x)) {
-                                     return '-';
-                                   }
-                                   return *ranges::begin(x);
-                                 }) |
-                                 ranges::to<std::vector>;
-                        });
-
-  // Basically transpose the stacks and put them in a stack
-  std::vector<std::deque<char>> s(9);
-  ranges::for_each(cleaned_stacks | ranges::views::reverse, [&](auto x) {
-    ranges::for_each(x | ranges::views::enumerate, [&](auto t) {
-      auto i = std::get<0>(t);
-      auto c = std::get<1>(t);
-      if (c != '-') {
-        s[i].push_front(c);
-      }
-    });
-  });
+/// A single stack of crates, stored contiguously with the top most crate at
+/// the back, so moves only ever touch the end of the buffer
+using Stack = std::vector<char>;
+using Stacks = std::vector<Stack>;
+
+/// Packed form of "move num from from to to", with 0-based stack indices
+struct Move {
+  std::uint32_t num;
+  std::uint16_t from;
+  std::uint16_t to;
+};
 
-  return s;
+/// The drawing of the stacks ends with the line of stack numbers, which is
+/// followed by an empty line. Returns the number of lines with crates in them
+std::size_t drawing_height(const std::vector<std::string> &in) {
+  auto it = ranges::find(in, std::string{});
+  return static_cast<std::size_t>(ranges::distance(in.begin(), it)) - 1;
 }
 
-/// Process list of commands each of the form "move x from y to z" -> [x, y, z]
-std::vector<std::vector<int>>
-process_commands(const std::vector<std::string> &in) {
-  std::vector<std::string> commands(in.begin() + 10, in.end());
+Stacks process_start_stack(const std::vector<std::string> &in) {
+  auto height = drawing_height(in);
 
-  auto word_to_string = [](auto word) {
-    return word | ranges::to<std::string>;
-  };
+  // Labels are at position 1, 5, 9, ..., the trailing space might be missing
+  auto num_stacks = (in[height].size() + 2) / 4;
 
-  auto not_all_digits = [](auto str) {
-    return !ranges::accumulate(str, true, [](auto accu, auto c) {
-      return accu && std::isdigit(static_cast<unsigned char>(c));
-    });
+  auto is_crate = [&](std::size_t row, std::size_t i) {
+    auto pos = 4 * i + 1;
+    return pos < in[row].size() &&
+           std::isalpha(static_cast<unsigned char>(in[row][pos]));
   };
 
-  auto to_int = [](auto str) { return std::stoi(str); };
-
-  auto cmd = commands | ranges::views::transform([&](auto x) {
-               // Split by spaces, then ensure that words are stored as string
-               // (avoid dangling), then remove all words, which are not
-               // numbers, then convert the strings to numbers
-               return x | ranges::views::split(' ') |
-                      ranges::views::transform(word_to_string) |
-                      ranges::views::remove_if(not_all_digits) |
-                      ranges::views::transform(to_int) |
-                      ranges::to<std::vector>;
-             }) |
-             ranges::to<std::vector>;
-
-  return cmd;
+  Stacks stacks(num_stacks);
+
+  // Walk the drawing bottom up, such that the top ends up at the back
+  for (auto row = height; row-- > 0;) {
+    for (std::size_t i = 0; i < num_stacks; ++i) {
+      if (is_crate(row, i)) {
+        stacks[i].push_back(in[row][4 * i + 1]);
+      }
+    }
+  }
+
+  return stacks;
 }
 
-auto execute_commands(std::vector<std::deque<char>> stacks,
-                      const std::vector<std::vector<int>> &cmds, auto move_fn) {
-  auto unpack = [](auto t) {
-    auto first = ranges::begin(t);
-    auto second = ranges::next(first);
-    auto third = ranges::next(second);
-    return std::make_tuple(*first, *second, *third);
-  };
+/// Process list of commands each of the form "move x from y to z" -> {x, y-1,
+/// z-1}
+std::vector<Move> process_commands(const std::vector<std::string> &in) {
+  auto first = drawing_height(in) + 2;
 
-  // Helper to pretty print the current stack
-  auto print_stack = [](auto stack) {
-    ranges::for_each(stack | ranges::views::enumerate, [](auto t) {
-      fmt::print("{}: {}\n", std::get<0>(t) + 1,
-                 std::get<1>(t) | ranges::views::reverse);
-    });
-  };
+  std::vector<Move> cmds;
+  cmds.reserve(in.size() - first);
 
-  // Helper to print the command
-  auto print_cmd = [&](auto i, auto cmd) {
-    auto [num, from, to] = unpack(cmd);
-    fmt::print("{}: move {} from {} to {}\n", i, num, from, to);
-  };
+  for (const auto &line : in | ranges::views::drop(first)) {
+    // Pick the three numbers out of the line, skipping all words
+    std::uint32_t nums[3] = {0, 0, 0};
+    auto cur = line.data();
+    auto last = line.data() + line.size();
+    for (auto &n : nums) {
+      while (cur != last && !std::isdigit(static_cast<unsigned char>(*cur))) {
+        ++cur;
+      }
+      cur = std::from_chars(cur, last, n).ptr;
+    }
 
-  // For each command, call the move function
-  ranges::for_each(cmds, [&](auto cmd) {
-    auto [num, from, to] = unpack(cmd);
-    move_fn(stacks, num, from, to);
-
-    // now delete the elements from the source stack
-    stacks[from - 1].erase(ranges::begin(stacks[from - 1]),
-                           ranges::begin(stacks[from - 1]) + num);
-  });
-
-  /* If I want to debug I can use this:
-  auto tmp = cmds | ranges::views::enumerate;
-  ranges::for_each(tmp, [&](auto t) {
-    auto i = std::get<0>(t);
-    auto cmd = std::get<1>(t);
-    auto [num, from, to] = unpack(cmd);
-
-    print_cmd(i, cmd);
-    print_stack(stacks);
-    move_fn(stacks, num, from, to);
-    fmt::print("\n");
-    print_stack(stacks);
-    fmt::print("\n");
-  });
-  */
-
-  /// remove all but the first element of the stack (i.e. the top most
-  /// element), convert this to a string and return it
-  auto to_char = [](auto x) {
-    auto t = x | ranges::views::take(1);
-    return static_cast<char>(*ranges::begin(t));
-  };
+    if (nums[1] == 0 || nums[2] == 0) {
+      fmt::print("ERROR: {}\n", line);
+      continue;
+    }
+
+    cmds.push_back(Move{nums[0], static_cast<std::uint16_t>(nums[1] - 1),
+                        static_cast<std::uint16_t>(nums[2] - 1)});
+  }
 
-  return stacks | ranges::views::transform(to_char) | ranges::to<std::string>;
+  return cmds;
 }
 
-auto split_stacks(const std::vector<std::string> &in) {
-  auto stacks = process_start_stack(in);
-  auto commands = process_commands(in);
+/// Which crane is used, CrateMover 9000 moves one crate at a time and
+/// therefore reverses the moved crates, CrateMover 9001 moves them all at once
+enum class Crane { CrateMover9000, CrateMover9001 };
+
+/// CrateMover 9000: the crates are moved one at a time, so they end up in
+/// reverse order on the target stack
+void move_9000(Stack &from, Stack &to, std::size_t num) {
+  auto first = from.end() - num;
+  to.insert(to.end(), std::make_reverse_iterator(from.end()),
+            std::make_reverse_iterator(first));
+  from.erase(first, from.end());
+}
+
+/// CrateMover 9001: all crates are moved at once, keeping their order
+void move_9001(Stack &from, Stack &to, std::size_t num) {
+  auto offset = to.size();
+  to.resize(offset + num);
+  std::memcpy(to.data() + offset, from.data() + from.size() - num, num);
+  from.resize(from.size() - num);
+}
+
+/// The top most element is the last one of each stack
+std::string top_crates(const Stacks &stacks) {
+  return stacks | ranges::views::transform([](const auto &s) {
+           return s.empty() ? ' ' : s.back();
+         }) |
+         ranges::to<std::string>;
+}
 
-  return std::make_tuple(stacks, commands);
+std::string execute_commands(const Stacks &start,
+                             const std::vector<Move> &cmds, auto move_fn) {
+  // Stacks grow by amortised doubling, reserving room for all crates in every
+  // stack would take stacks * crates bytes
+  auto stacks = start;
+  for (auto cmd : cmds) {
+    // Moving crates onto the same stack doesn't change anything for both
+    // cranes
+    if (cmd.from != cmd.to) {
+      move_fn(stacks[cmd.from], stacks[cmd.to], cmd.num);
+    }
+  }
+
+  return top_crates(stacks);
 }
 
-void part1(const std::vector<std::string> &in) {
-  auto [stacks, commands] = split_stacks(in);
+/// Determine the top crates without moving a single crate. Each final top
+/// position is traced backwards through the commands to the (stack, depth) it
+/// started at, which is then looked up in the start stacks. This takes
+/// O(commands * stacks) regardless of the number of crates moved.
+std::string trace_top_crates(const Stacks &stacks,
+                             const std::vector<Move> &cmds, Crane crane) {
+  // Only the final heights are needed, to know which stacks end up empty
+  std::vector<std::size_t> heights(stacks.size());
+  ranges::transform(stacks, heights.begin(),
+                    [](const auto &s) { return s.size(); });
+  for (auto cmd : cmds) {
+    heights[cmd.from] -= cmd.num;
+    heights[cmd.to] += cmd.num;
+  }
 
-  // In part 1, each element is moved element by element
-  auto move = [](auto &stacks, auto num, auto from, auto to) {
-    ranges::copy(stacks[from - 1] | ranges::views::take(num),
-                 std::front_inserter(stacks[to - 1]));
+  // Positions are given as stack index and depth counted from the top
+  struct Position {
+    std::size_t stack;
+    std::size_t depth;
   };
-  auto top = execute_commands(stacks, commands, move);
 
-  fmt::print("Top of final stack: {}\n", top);
+  std::vector<Position> positions;
+  positions.reserve(stacks.size());
+  for (std::size_t i = 0; i < stacks.size(); ++i) {
+    positions.push_back(Position{i, 0});
+  }
+
+  for (auto cmd : cmds | ranges::views::reverse) {
+    if (cmd.from == cmd.to) {
+      continue;
+    }
+
+    for (auto &pos : positions) {
+      if (pos.stack == cmd.to) {
+        if (pos.depth < cmd.num) {
+          // The crate was part of the moved crates
+          pos.stack = cmd.from;
+          if (crane == Crane::CrateMover9000) {
+            pos.depth = cmd.num - 1 - pos.depth;
+          }
+        } else {
+          pos.depth -= cmd.num;
+        }
+      } else if (pos.stack == cmd.from) {
+        // The moved crates were on top of it
+        pos.depth += cmd.num;
+      }
+    }
+  }
+
+  std::string top(stacks.size(), ' ');
+  for (std::size_t i = 0; i < stacks.size(); ++i) {
+    if (heights[i] != 0) {
+      const auto &s = stacks[positions[i].stack];
+      top[i] = s[s.size() - 1 - positions[i].depth];
+    }
+  }
+  return top;
+}
+
+/// Stacks stored as piece tables over one shared immutable buffer of all start
+/// crates. Each stack is an implicit treap of pieces, i.e. ranges of the
+/// buffer, ordered bottom to top. Moving n crates splits one treap and merges
+/// it into another in O(log pieces), independent of n. The CrateMover 9000
+/// reversal is a lazy flag on the moved subtree.
+class PieceStacks {
+public:
+  explicit PieceStacks(const Stacks &stacks) {
+    auto crates = std::make_shared<std::string>();
+    for (const auto &s : stacks) {
+      crates->append(s.begin(), s.end());
+    }
+    crates_ = std::move(crates);
+
+    // Node 0 is the empty tree
+    nodes_.push_back(Node{});
+
+    std::uint32_t offset = 0;
+    for (const auto &s : stacks) {
+      auto length = static_cast<std::uint32_t>(s.size());
+      roots_.push_back(length == 0 ? 0
+                                   : new_node(Piece{offset, length, false}));
+      offset += length;
+    }
+  }
+
+  std::size_t num_stacks() const { return roots_.size(); }
+
+  std::size_t size(std::size_t stack) const {
+    return nodes_[roots_[stack]].total;
+  }
+
+  void move(std::size_t from, std::size_t to, std::size_t num, Crane crane) {
+    auto [rest, moved] = split(roots_[from], size(from) - num);
+    if (crane == Crane::CrateMover9000) {
+      nodes_[moved].flip = !nodes_[moved].flip;
+    }
+    roots_[from] = rest;
+    roots_[to] = merge(roots_[to], moved);
+  }
+
+  /// Top most crate, or ' ' for an empty stack. Follows the right spine and
+  /// only accounts for pending flips, so it doesn't modify the tree
+  char top(std::size_t stack) const {
+    auto t = roots_[stack];
+    if (t == 0) {
+      return ' ';
+    }
+
+    bool flip = false;
+    while (true) {
+      const auto &node = nodes_[t];
+      flip = flip != node.flip;
+      auto next = flip ? node.left : node.right;
+      if (next == 0) {
+        auto [offset, length, reversed] = node.piece;
+        return (reversed != flip) ? (*crates_)[offset]
+                                  : (*crates_)[offset + length - 1];
+      }
+      t = next;
+    }
+  }
+
+private:
+  /// A range of the crate buffer, if reversed the last crate of the range is
+  /// the bottom most one
+  struct Piece {
+    std::uint32_t offset;
+    std::uint32_t length;
+    bool reversed;
+  };
+
+  struct Node {
+    Piece piece{0, 0, false};
+    std::uint32_t left = 0;
+    std::uint32_t right = 0;
+    std::uint32_t priority = 0;
+    // Number of crates in the subtree
+    std::size_t total = 0;
+    // The subtree still needs to be reversed
+    bool flip = false;
+  };
+
+  std::uint32_t new_node(Piece piece) {
+    nodes_.push_back(Node{piece, 0, 0, static_cast<std::uint32_t>(rng_()),
+                          piece.length, false});
+    return static_cast<std::uint32_t>(nodes_.size() - 1);
+  }
+
+  void update(std::uint32_t t) {
+    auto &node = nodes_[t];
+    node.total = nodes_[node.left].total + node.piece.length +
+                 nodes_[node.right].total;
+  }
+
+  void push(std::uint32_t t) {
+    auto &node = nodes_[t];
+    if (node.flip) {
+      std::swap(node.left, node.right);
+      node.piece.reversed = !node.piece.reversed;
+      nodes_[node.left].flip = !nodes_[node.left].flip;
+      nodes_[node.right].flip = !nodes_[node.right].flip;
+      node.flip = false;
+      // Flipping the empty tree is meaningless
+      nodes_[0].flip = false;
+    }
+  }
+
+  /// Split into the bottom k crates and the rest, splitting at most one piece
+  std::pair<std::uint32_t, std::uint32_t> split(std::uint32_t t,
+                                                std::size_t k) {
+    if (t == 0) {
+      return {0, 0};
+    }
+    push(t);
+
+    auto left_total = nodes_[nodes_[t].left].total;
+    auto length = nodes_[t].piece.length;
+
+    if (k <= left_total) {
+      auto [a, b] = split(nodes_[t].left, k);
+      nodes_[t].left = b;
+      update(t);
+      return {a, t};
+    }
+
+    if (k >= left_total + length) {
+      auto [a, b] = split(nodes_[t].right, k - left_total - length);
+      nodes_[t].right = a;
+      update(t);
+      return {t, b};
+    }
+
+    // The split point is inside of this piece, the upper part becomes a new
+    // node taking over the right subtree
+    auto j = static_cast<std::uint32_t>(k - left_total);
+    auto [offset, len, reversed] = nodes_[t].piece;
+    auto lower = reversed ? Piece{offset + len - j, j, true}
+                          : Piece{offset, j, false};
+    auto upper = reversed ? Piece{offset, len - j, true}
+                          : Piece{offset + j, len - j, false};
+
+    auto n = new_node(upper);
+    nodes_[n].priority = nodes_[t].priority;
+    nodes_[n].right = nodes_[t].right;
+    nodes_[t].right = 0;
+    nodes_[t].piece = lower;
+    update(n);
+    update(t);
+    return {t, n};
+  }
+
+  std::uint32_t merge(std::uint32_t a, std::uint32_t b) {
+    if (a == 0 || b == 0) {
+      return a == 0 ? b : a;
+    }
+
+    if (nodes_[a].priority > nodes_[b].priority) {
+      push(a);
+      nodes_[a].right = merge(nodes_[a].right, b);
+      update(a);
+      return a;
+    }
+
+    push(b);
+    nodes_[b].left = merge(a, nodes_[b].left);
+    update(b);
+    return b;
+  }
+
+  std::shared_ptr<const std::string> crates_;
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> roots_;
+  std::minstd_rand rng_{5};
+};
+
+std::string execute_commands(PieceStacks stacks, const std::vector<Move> &cmds,
+                             Crane crane) {
+  for (auto cmd : cmds) {
+    if (cmd.from != cmd.to) {
+      stacks.move(cmd.from, cmd.to, cmd.num, crane);
+    }
+  }
+
+  std::string top(stacks.num_stacks(), ' ');
+  for (std::size_t i = 0; i < stacks.num_stacks(); ++i) {
+    top[i] = stacks.top(i);
+  }
+  return top;
 }
 
-void part2(const std::vector<std::string> &in) {
-  auto [stacks, commands] = split_stacks(in);
+/// Answers queries about the stacks after the first k commands. A compact
+/// snapshot of all stacks is recorded every `interval()` commands, with the
+/// interval chosen such that the snapshots and the copy of the commands fit
+/// into the given memory budget. The snapshot of the start is always taken,
+/// even if it alone exceeds the budget. A query restores the closest snapshot
+/// before k and replays the remaining commands, which are less than
+/// `interval()`.
+class CommandReplay {
+public:
+  CommandReplay(const Stacks &stacks, const std::vector<Move> &cmds,
+                Crane crane, std::size_t memory_budget)
+      : cmds_(cmds), crane_(crane) {
+    std::size_t total = 0;
+    for (const auto &s : stacks) {
+      total += s.size();
+    }
+
+    // Each snapshot stores all crates and the height of each stack
+    auto snapshot_bytes =
+        sizeof(Snapshot) + total + stacks.size() * sizeof(std::uint32_t);
+    auto cmds_bytes = cmds_.size() * sizeof(Move);
+    auto max_snapshots = memory_budget > cmds_bytes
+                             ? (memory_budget - cmds_bytes) / snapshot_bytes
+                             : 0;
+
+    // Snapshots are taken after 0, interval_, 2 * interval_, ... commands,
+    // that's cmds_.size() / interval_ + 1 of them
+    if (max_snapshots < 2) {
+      interval_ = cmds_.size() + 1;
+    } else {
+      interval_ = std::max<std::size_t>(
+          (cmds_.size() + max_snapshots - 2) / (max_snapshots - 1), 1);
+    }
+
+    snapshots_.reserve(cmds_.size() / interval_ + 1);
+
+    auto cur = stacks;
+    for (std::size_t k = 0; k <= cmds_.size(); ++k) {
+      if (k % interval_ == 0) {
+        snapshots_.push_back(make_snapshot(cur));
+      }
+      if (k < cmds_.size()) {
+        apply(cur, cmds_[k]);
+      }
+    }
+  }
+
+  std::size_t interval() const { return interval_; }
+
+  /// All stacks after the first k commands have been executed
+  Stacks stacks_after(std::size_t k) const {
+    k = std::min(k, cmds_.size());
+    auto checkpoint = k / interval_;
+    auto stacks = restore(snapshots_[checkpoint]);
+
+    for (auto i = checkpoint * interval_; i < k; ++i) {
+      apply(stacks, cmds_[i]);
+    }
+    return stacks;
+  }
+
+  Stack stack_after(std::size_t k, std::size_t stack) const {
+    return stacks_after(k)[stack];
+  }
 
-  // To move them "all at once", just reverse them first and then copy them
-  // bit by bit
-  auto move = [](auto &stacks, auto num, auto from, auto to) {
-    ranges::copy(stacks[from - 1] | ranges::views::take(num) |
-                     ranges::views::reverse,
-                 std::front_inserter(stacks[to - 1]));
+  std::string top_after(std::size_t k) const {
+    return top_crates(stacks_after(k));
+  }
+
+private:
+  /// All crates concatenated bottom to top, plus the height of each stack
+  struct Snapshot {
+    std::string crates;
+    std::vector<std::uint32_t> heights;
   };
 
-  auto top = execute_commands(stacks, commands, move);
+  void apply(Stacks &stacks, Move cmd) const {
+    if (cmd.from == cmd.to) {
+      return;
+    }
+
+    if (crane_ == Crane::CrateMover9000) {
+      move_9000(stacks[cmd.from], stacks[cmd.to], cmd.num);
+    } else {
+      move_9001(stacks[cmd.from], stacks[cmd.to], cmd.num);
+    }
+  }
+
+  static Snapshot make_snapshot(const Stacks &stacks) {
+    Snapshot snapshot;
+    snapshot.heights.reserve(stacks.size());
+    for (const auto &s : stacks) {
+      snapshot.crates.append(s.begin(), s.end());
+      snapshot.heights.push_back(static_cast<std::uint32_t>(s.size()));
+    }
+    return snapshot;
+  }
+
+  static Stacks restore(const Snapshot &snapshot) {
+    Stacks stacks(snapshot.heights.size());
+
+    auto first = snapshot.crates.begin();
+    for (std::size_t i = 0; i < stacks.size(); ++i) {
+      stacks[i].assign(first, first + snapshot.heights[i]);
+      first += snapshot.heights[i];
+    }
+    return stacks;
+  }
+
+  std::vector<Move> cmds_;
+  Crane crane_;
+  std::size_t interval_;
+  std::vector<Snapshot> snapshots_;
+};
+
+void part1(const Stacks &stacks, const std::vector<Move> &commands) {
+  auto top = execute_commands(stacks, commands, move_9000);
+
+  fmt::print("Top of final stack: {}\n", top);
+  fmt::print("Top of final stack (traced): {}\n",
+             trace_top_crates(stacks, commands, Crane::CrateMover9000));
+  fmt::print("Top of final stack (piece table): {}\n",
+             execute_commands(PieceStacks{stacks}, commands,
+                              Crane::CrateMover9000));
+}
+
+void part2(const Stacks &stacks, const std::vector<Move> &commands) {
+  auto top = execute_commands(stacks, commands, move_9001);
 
   fmt::print("Top of final stack with CrateMover 9001: {}\n", top);
+  fmt::print("Top of final stack with CrateMover 9001 (traced): {}\n",
+             trace_top_crates(stacks, commands, Crane::CrateMover9001));
+  fmt::print("Top of final stack with CrateMover 9001 (piece table): {}\n",
+             execute_commands(PieceStacks{stacks}, commands,
+                              Crane::CrateMover9001));
 }
 
 int main() {
   auto in = input();
-  part1(in);
-  part2(in);
+  auto stacks = process_start_stack(in);
+  auto commands = process_commands(in);
+
+  part1(stacks, commands);
+  part2(stacks, commands);
+
+  // Keep the snapshots below 1 MiB, and look at the stacks half way through
+  CommandReplay replay(stacks, commands, Crane::CrateMover9001, 1 << 20);
+  auto half = commands.size() / 2;
+  fmt::print("Top of stack after {} commands with CrateMover 9001: {} "
+             "(snapshot every {} commands)\n",
+             half, replay.top_after(half), replay.interval());
 }
@@ -1,5 +1,12 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -9,45 +16,191 @@
 #include <fmt/ranges.h>
 #include <range/v3/all.hpp>
 
-#include "input.hpp"
-
-std::size_t first_all_different(const std::string s, int range) {
-  auto all_different =
-      s | ranges::views::sliding(range) | ranges::views::transform([](auto x) {
-        // all are different, if the sorted and uniqued size is the same as
-        // original
-        auto size = ranges::size(x);
-        auto unique = std::move(x | ranges::to<std::vector>) |
-                      ranges::actions::sort | ranges::actions::unique;
-        return size == ranges::size(unique);
-      });
-
-  // find the first where all chars are different one, it's lazy so no extra
-  // computation
-  auto first_different = ranges::find(all_different, true);
-
-  auto first = ranges::begin(all_different);
-  return ranges::distance(first, first_different) + range;
+/// Returns the number of characters processed until the last `range`
+/// characters are all different, or std::string::npos if there is no such
+/// window. The window start skips past the last occurrence of every character
+/// that is seen again, so this is linear in the size of the string,
+/// independent of `range`, and doesn't allocate.
+std::size_t first_all_different(std::string_view s, std::size_t range) {
+  // Position + 1 of the last occurrence of each character, 0 if not seen yet
+  std::array<std::size_t, 256> last_seen{};
+
+  std::size_t window_start = 0;
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    auto &last = last_seen[static_cast<unsigned char>(s[i])];
+    window_start = std::max(window_start, last);
+    last = i + 1;
+
+    if (i + 1 - window_start == range) {
+      return i + 1;
+    }
+  }
+  return std::string::npos;
+}
+
+/// Detects the markers for several window sizes at once on a stream, which is
+/// consumed chunk by chunk. Since the window start only depends on the
+/// characters seen so far, all window sizes share a single scan and the state
+/// has constant size.
+class MarkerStream {
+public:
+  explicit MarkerStream(std::vector<std::size_t> ranges)
+      : ranges_(std::move(ranges)), markers_(ranges_.size(), std::string::npos),
+        remaining_(ranges_.size()) {}
+
+  /// Consume the next chunk of the stream, returns true once all markers are
+  /// found
+  bool consume(std::string_view chunk) {
+    for (auto c : chunk) {
+      if (done()) {
+        break;
+      }
+
+      auto &last = last_seen_[static_cast<unsigned char>(c)];
+      window_start_ = std::max(window_start_, last);
+      last = ++processed_;
+
+      // The window grows by at most one each step, so the first time it's
+      // large enough, it has exactly the right size
+      auto length = processed_ - window_start_;
+      for (std::size_t i = 0; i < ranges_.size(); ++i) {
+        if (markers_[i] == std::string::npos && length >= ranges_[i]) {
+          markers_[i] = processed_;
+          --remaining_;
+        }
+      }
+    }
+    return done();
+  }
+
+  bool done() const { return remaining_ == 0; }
+
+  /// Position of the marker for the i-th window size, std::string::npos if it
+  /// wasn't found (yet)
+  std::size_t marker(std::size_t i) const { return markers_[i]; }
+
+  std::size_t processed() const { return processed_; }
+
+private:
+  std::array<std::uint64_t, 256> last_seen_{};
+  std::uint64_t processed_ = 0;
+  std::uint64_t window_start_ = 0;
+
+  std::vector<std::size_t> ranges_;
+  std::vector<std::size_t> markers_;
+  std::size_t remaining_;
+};
+
+/// Feed the first line of the stream in fixed size chunks to the detector,
+/// until all markers are found
+void scan_stream(std::istream &is, MarkerStream &detector) {
+  std::array<char, 1 << 16> buffer;
+
+  while (!detector.done() && is) {
+    is.read(buffer.data(), buffer.size());
+    auto chunk = std::string_view(buffer.data(), is.gcount());
+
+    auto eol = chunk.find('\n');
+    detector.consume(chunk.substr(0, eol));
+    if (eol != std::string_view::npos) {
+      break;
+    }
+  }
 }
 
-void part1(const std::string &in) {
-  int range = 4;
-  auto pos = first_all_different(in, range);
+/// Find the first marker of an already loaded buffer on multiple threads. The
+/// buffer is split into one segment per thread, each extended backwards by
+/// range - 1 characters such that every window ends in exactly one segment.
+/// The marker of the first segment with a hit is the global first one, so
+/// threads stop as soon as an earlier segment reports a hit.
+std::size_t parallel_first_all_different(
+    std::string_view s, std::size_t range,
+    std::size_t num_threads = std::thread::hardware_concurrency()) {
+  // Don't bother with threads for small buffers
+  constexpr std::size_t min_segment = 1 << 20;
+  num_threads = std::clamp<std::size_t>(s.size() / min_segment, 1,
+                                        std::max<std::size_t>(num_threads, 1));
+  if (num_threads == 1) {
+    return first_all_different(s, range);
+  }
+
+  constexpr std::size_t chunk_size = 1 << 16;
+  auto segment_size = (s.size() + num_threads - 1) / num_threads;
+
+  std::atomic<std::size_t> first_hit = num_threads;
+  std::vector<std::size_t> markers(num_threads, std::string::npos);
+
+  auto scan = [&](std::size_t i) {
+    auto last = std::min((i + 1) * segment_size, s.size());
+    auto first = std::max(i * segment_size, range - 1) - (range - 1);
+    auto segment = s.substr(first, last - first);
+
+    MarkerStream detector({range});
+    for (std::size_t offset = 0; offset < segment.size();
+         offset += chunk_size) {
+      if (first_hit.load(std::memory_order_relaxed) < i) {
+        return;
+      }
+
+      if (detector.consume(segment.substr(offset, chunk_size))) {
+        markers[i] = first + detector.marker(0);
+
+        auto current = first_hit.load();
+        while (i < current && !first_hit.compare_exchange_weak(current, i)) {
+        }
+        return;
+      }
+    }
+  };
 
-  fmt::print("Processed characters till first 4 different: {}, {}\n", pos,
-             in.substr(pos - range - 1, range));
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(scan, i);
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  auto hit = first_hit.load();
+  return hit == num_threads ? std::string::npos : markers[hit];
 }
 
-void part2(const std::string &in) {
-  int range = 14;
-  auto pos = first_all_different(in, range);
+void part1(const MarkerStream &detector) {
+  fmt::print("Processed characters till first 4 different: {}\n",
+             detector.marker(0));
+}
 
-  fmt::print("Processed characters till first 4 different: {}, {}\n", pos,
-             in.substr(pos - range - 1, range));
+void part2(const MarkerStream &detector) {
+  fmt::print("Processed characters till first 14 different: {}\n",
+             detector.marker(1));
 }
 
-int main() {
-  auto in = input();
-  part1(in.front());
-  part2(in.front());
+int main(int argc, char *argv[]) {
+  MarkerStream detector({4, 14});
+
+  // With --parallel the signal is loaded into memory and additionally searched
+  // on multiple threads
+  if (argc > 1 && std::string_view(argv[1]) == "--parallel") {
+    std::string signal;
+    std::getline(std::cin, signal);
+    detector.consume(signal);
+
+    part1(detector);
+    part2(detector);
+
+    fmt::print("Processed characters till first 4 different (parallel): {}\n",
+               parallel_first_all_different(signal, 4));
+    fmt::print(
+        "Processed characters till first 14 different (parallel): {}\n",
+        parallel_first_all_different(signal, 14));
+    return 0;
+  }
+
+  // The stream might be too large to hold in memory, so scan it once for both
+  // window sizes while reading it
+  scan_stream(std::cin, detector);
+
+  part1(detector);
+  part2(detector);
 }
@@ -1,6 +1,13 @@
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <set>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
@@ -11,6 +18,7 @@
 #include <range/v3/all.hpp>
 
 #include "input.hpp"
+#include "overloaded.hpp"
 
 struct File {
   std::size_t size;
@@ -19,174 +27,366 @@ struct File {
 
 struct Dir {
   std::string name;
-  std::size_t size;
-  std::vector<Dir> dirs{};
-  std::vector<File> files{};
-  Dir *toplevel = nullptr;
 };
 
 struct CommandCD {
-  Dir argument;
+  std::string argument;
 };
 
 struct CommandCDUp {};
 
-using Command = std::variant<CommandCD, CommandCDUp>;
-using Commands = std::vector<Command>;
+struct CommandCDRoot {};
+
+using Command = std::variant<CommandCD, CommandCDUp, CommandCDRoot>;
 using Input = std::variant<File, Dir, Command>;
 
 auto parse_input(const std::vector<std::string> &in) {
   using namespace std::string_view_literals;
 
   std::vector<Input> input;
+  input.reserve(in.size());
+
+  for (const auto &line : in) {
+    if (line.empty()) {
+      continue;
+    }
 
-  for (auto line : in) {
     if (line.front() == '$') {
       if (line.starts_with("$ cd"sv)) {
         auto space_pos = line.rfind(' ');
 
-        const auto argument = line.substr(space_pos + 1, line.size());
+        auto argument = line.substr(space_pos + 1, line.size());
         if (argument == ".."sv) {
           input.push_back(CommandCDUp{});
+        } else if (argument == "/"sv) {
+          input.push_back(CommandCDRoot{});
         } else {
-          input.push_back(CommandCD{argument, 0});
+          input.push_back(CommandCD{std::move(argument)});
         }
       }
     } else if (line.starts_with("dir"sv)) {
       auto space_pos = line.find(' ');
-      input.push_back(Dir{line.substr(space_pos + 1, line.size()), 0});
+      input.push_back(Dir{line.substr(space_pos + 1, line.size())});
     } else {
       auto space_pos = line.find(' ');
       auto size = std::stoul(line.substr(0, space_pos));
-      auto name = line.substr(space_pos, line.size());
+      auto name = line.substr(space_pos + 1, line.size());
       input.push_back(File{size, name});
     }
   }
   return input;
 }
 
+using NodeId = std::uint32_t;
+constexpr NodeId no_node = std::numeric_limits<NodeId>::max();
+
+/// A directory, children are linked through first_child and next_sibling
+struct Node {
+  std::uint32_t name;
+  NodeId parent = no_node;
+  NodeId first_child = no_node;
+  NodeId next_sibling = no_node;
+  // Size of the files directly in this directory
+  std::size_t files = 0;
+  // Size including all subdirectories, valid after compute_sizes()
+  std::size_t size = 0;
+};
+
+/// All directories live in one flat vector and refer to each other by index,
+/// so adding directories never invalidates anything. Names are interned, and a
+/// single hash map keyed by (parent, name) serves as the child lookup of every
+/// directory, which makes cd O(1).
+class FileSystem {
+public:
+  FileSystem() { nodes_.push_back(Node{intern("/")}); }
+
+  NodeId root() const { return 0; }
+
+  const std::vector<Node> &nodes() const { return nodes_; }
+
+  const Node &node(NodeId id) const { return nodes_[id]; }
+
+  const std::string &name(NodeId id) const { return names_[nodes_[id].name]; }
+
+  /// Look up the subdirectory with the given name, it's created if it didn't
+  /// show up in a listing before
+  NodeId child(NodeId parent, std::string_view name) {
+    auto name_id = intern(name);
+    auto [it, inserted] =
+        children_.try_emplace(key(parent, name_id), NodeId(nodes_.size()));
+    if (inserted) {
+      Node node{name_id, parent, no_node, nodes_[parent].first_child};
+      nodes_.push_back(node);
+      nodes_[parent].first_child = it->second;
+    }
+    return it->second;
+  }
+
+  /// Add a file to the directory, files listed repeatedly are counted once.
+  /// Returns true if the file is new
+  bool add_file(NodeId dir, std::string_view name, std::size_t size) {
+    if (files_.insert(key(dir, intern(name))).second) {
+      nodes_[dir].files += size;
+      return true;
+    }
+    return false;
+  }
+
+  /// Add delta to the size of dir and all its ancestors in O(depth), calling
+  /// on_resize(old_size, new_size) for each of them. This keeps the sizes
+  /// valid without another call to compute_sizes()
+  void propagate(NodeId dir, std::size_t delta, auto on_resize) {
+    for (auto id = dir; id != no_node; id = nodes_[id].parent) {
+      auto old_size = nodes_[id].size;
+      nodes_[id].size += delta;
+      on_resize(old_size, nodes_[id].size);
+    }
+  }
+
+  /// Determine the size of each directory. Children are always created after
+  /// their parent, so walking the nodes backwards visits every directory
+  /// after all of its subdirectories, like an iterative post-order traversal.
+  void compute_sizes() {
+    for (auto &node : nodes_) {
+      node.size = node.files;
+    }
+    for (auto id = nodes_.size(); id-- > 1;) {
+      nodes_[nodes_[id].parent].size += nodes_[id].size;
+    }
+  }
+
+private:
+  static std::uint64_t key(NodeId dir, std::uint32_t name) {
+    return (static_cast<std::uint64_t>(dir) << 32) | name;
+  }
+
+  std::uint32_t intern(std::string_view name) {
+    auto [it, inserted] = name_ids_.try_emplace(
+        std::string(name), static_cast<std::uint32_t>(names_.size()));
+    if (inserted) {
+      names_.push_back(it->first);
+    }
+    return it->second;
+  }
+
+  std::vector<Node> nodes_;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, std::uint32_t> name_ids_;
+  std::unordered_map<std::uint64_t, NodeId> children_;
+  std::unordered_set<std::uint64_t> files_;
+};
+
 struct CommandVisitor {
   auto operator()(const CommandCD &cmd) const {
-    auto &dirs = curdir->dirs;
-    auto it = std::find_if(dirs.begin(), dirs.end(), [&](auto dir) {
-      return dir.name == cmd.argument.name;
-    });
+    return fs.child(curdir, cmd.argument);
+  }
 
-    // I know I should check for end iterator, but I know it will find something
-    // here due the assignment, but I'm not checking for nullptr anywhere
-    // anyway, so I DON'T CARE :D
-    return &(*it);
+  auto operator()(CommandCDUp) const {
+    // cd .. in the root directory stays there
+    auto parent = fs.node(curdir).parent;
+    return parent == no_node ? curdir : parent;
   }
 
-  auto operator()(CommandCDUp) const { return curdir->toplevel; }
+  auto operator()(CommandCDRoot) const { return fs.root(); }
 
-  Dir *curdir;
+  FileSystem &fs;
+  NodeId curdir;
 };
 
 struct InputVisitor {
 public:
   auto operator()(const Command &cmd) {
-    curdir = std::visit(CommandVisitor{curdir}, cmd);
+    curdir = std::visit(CommandVisitor{fs, curdir}, cmd);
     return curdir;
   }
 
   auto operator()(const Dir &dir) {
-    curdir->dirs.push_back(dir);
-    curdir->dirs.back().toplevel = curdir;
+    fs.child(curdir, dir.name);
     return curdir;
   };
   auto operator()(const File &file) {
-    curdir->files.push_back(file);
+    fs.add_file(curdir, file.name, file.size);
     return curdir;
   };
 
-  Dir *curdir;
+  FileSystem &fs;
+  NodeId curdir;
 };
 
-// This is damn ugly, I don't like it p.q
-std::size_t dirsize(Dir &dir) {
-  auto size = 0;
-  for (auto f : dir.files) {
-    size += f.size;
-  }
-  for (auto &d : dir.dirs) {
-    auto s = dirsize(d);
-    d.size = s;
-    size += s;
+FileSystem populate_filesystem(const std::vector<Input> &input) {
+  FileSystem fs;
+  NodeId curdir = fs.root();
+  for (const auto &inp : input) {
+    curdir = std::visit(InputVisitor{fs, curdir}, inp);
   }
-  dir.size = size;
-  return size;
+
+  // determine size of each folder
+  fs.compute_sizes();
+
+  return fs;
 }
 
-Dir populate_filesystem(const std::vector<Input> &input) {
-  Dir root{"/", 0, {}, {}, nullptr};
-  Dir *curdir = &root;
-  for (auto inp : input | ranges::views::drop(1)) {
-    curdir = std::visit(InputVisitor{curdir}, inp);
+/// All directory sizes in sorted order with prefix sums, built once after the
+/// sizes are computed. Threshold queries are then binary searches.
+class SizeIndex {
+public:
+  explicit SizeIndex(const FileSystem &fs) {
+    sizes_.reserve(fs.nodes().size());
+    for (const auto &node : fs.nodes()) {
+      sizes_.push_back(node.size);
+    }
+    ranges::sort(sizes_);
+
+    prefix_.reserve(sizes_.size() + 1);
+    prefix_.push_back(0);
+    for (auto size : sizes_) {
+      prefix_.push_back(prefix_.back() + size);
+    }
   }
 
-  // determine size of each folder
-  dirsize(root);
+  /// Sum of the sizes of all directories of at most the given size
+  std::size_t sum_at_most(std::size_t threshold) const {
+    auto it = ranges::upper_bound(sizes_, threshold);
+    return prefix_[static_cast<std::size_t>(it - sizes_.begin())];
+  }
 
-  return root;
-}
+  /// Smallest directory of at least the given size, or std::nullopt if all
+  /// directories are smaller
+  std::optional<std::size_t> smallest_at_least(std::size_t required) const {
+    auto it = ranges::lower_bound(sizes_, required);
+    if (it == sizes_.end()) {
+      return std::nullopt;
+    }
+    return *it;
+  }
 
-auto reducedir(const Dir &dir, auto pred, auto fn, auto init)
-    -> decltype(init) {
-  auto accum = init;
+  std::vector<std::size_t>
+  sum_at_most(const std::vector<std::size_t> &thresholds) const {
+    return thresholds |
+           ranges::views::transform([this](auto t) { return sum_at_most(t); }) |
+           ranges::to<std::vector>;
+  }
 
-  if (pred(dir)) {
-    accum = fn(accum, dir);
+  std::vector<std::optional<std::size_t>>
+  smallest_at_least(const std::vector<std::size_t> &required) const {
+    return required | ranges::views::transform([this](auto r) {
+             return smallest_at_least(r);
+           }) |
+           ranges::to<std::vector>;
   }
 
-  for (auto &d : dir.dirs) {
-    accum = reducedir(d, pred, fn, accum);
+private:
+  std::vector<std::size_t> sizes_;
+  std::vector<std::size_t> prefix_;
+};
+
+/// Keeps the directory sizes and answers up to date while the transcript is
+/// applied batch by batch. A new file only changes the sizes along its
+/// ancestor chain, and the sum of all small directories is adjusted as their
+/// sizes cross the threshold. The sizes are additionally kept in a multiset for
+/// the smallest directory query, which adds a log factor to each update.
+class LiveFileSystem {
+public:
+  explicit LiveFileSystem(std::size_t threshold = 100'000)
+      : threshold_(threshold) {
+    sizes_.insert(0);
+    sum_small_ = 0;
   }
 
-  return accum;
-}
+  void apply(const std::vector<Input> &batch) {
+    for (const auto &inp : batch) {
+      auto num_dirs = fs_.nodes().size();
+
+      std::visit(overloaded{
+                     [&](const Command &cmd) {
+                       curdir_ = std::visit(CommandVisitor{fs_, curdir_}, cmd);
+                     },
+                     [&](const Dir &dir) { fs_.child(curdir_, dir.name); },
+                     [&](const File &file) {
+                       if (fs_.add_file(curdir_, file.name, file.size)) {
+                         fs_.propagate(curdir_, file.size,
+                                       [this](auto old_size, auto new_size) {
+                                         resize(old_size, new_size);
+                                       });
+                       }
+                     }},
+                 inp);
+
+      // New directories are empty and therefore small
+      for (auto i = num_dirs; i < fs_.nodes().size(); ++i) {
+        sizes_.insert(0);
+      }
+    }
+  }
 
-// Nice, I like this
-std::size_t sumsmall(const Dir &dir) {
-  return reducedir(
-      dir, [](auto d) { return d.size <= 100'000; },
-      [](auto accum, auto dir) { return accum + dir.size; }, 0);
-}
+  const FileSystem &fs() const { return fs_; }
+
+  /// Sum of the sizes of all directories of at most threshold size
+  std::size_t sum_small() const { return sum_small_; }
 
-// This is damn ugly, I don't like it p.q
-std::size_t smallest_dir(const Dir &dir, std::size_t current_smallest,
-                         std::size_t remove_at_least) {
-  for (const auto &d : dir.dirs) {
-    current_smallest = smallest_dir(d, current_smallest, remove_at_least);
+  std::size_t smallest_dir(std::size_t remove_at_least) const {
+    auto it = sizes_.lower_bound(remove_at_least);
+    return it == sizes_.end() ? fs_.node(fs_.root()).size : *it;
   }
 
-  if (dir.size >= remove_at_least && dir.size < current_smallest) {
-    current_smallest = dir.size;
+private:
+  void resize(std::size_t old_size, std::size_t new_size) {
+    if (old_size <= threshold_) {
+      sum_small_ -= old_size;
+    }
+    if (new_size <= threshold_) {
+      sum_small_ += new_size;
+    }
+
+    sizes_.erase(sizes_.find(old_size));
+    sizes_.insert(new_size);
   }
-  return current_smallest;
-}
 
-void part1(const Dir &root) {
-  fmt::print("The sum of dirs smaller than 100'000: {}\n", sumsmall(root));
+  FileSystem fs_;
+  NodeId curdir_ = 0;
+  std::size_t threshold_;
+  std::size_t sum_small_;
+  std::multiset<std::size_t> sizes_;
+};
+
+void part1(const SizeIndex &index) {
+  fmt::print("The sum of dirs smaller than 100'000: {}\n",
+             index.sum_at_most(100'000));
 }
 
-void part2(const Dir &root) {
-  constexpr auto total_space = 70'000'000;
-  constexpr auto necessary_space = 30'000'000;
+constexpr std::size_t total_space = 70'000'000;
+constexpr std::size_t necessary_space = 30'000'000;
 
-  auto used_space = root.size;
+void part2(const FileSystem &fs, const SizeIndex &index) {
+  auto used_space = fs.node(fs.root()).size;
   auto free_space = total_space - used_space;
   auto remove_at_least = necessary_space - free_space;
 
-  auto free = smallest_dir(root, root.size, remove_at_least);
+  // The root directory is always large enough
+  auto free = index.smallest_at_least(remove_at_least).value_or(used_space);
   fmt::print("You need to delete a folder of size: {}\n", free);
 }
 
 int main() {
   auto in = input();
   auto input = parse_input(in);
-  auto root = populate_filesystem(input);
+  auto fs = populate_filesystem(input);
+  SizeIndex index(fs);
+
+  part1(index);
+  part2(fs, index);
+
+  // Apply the same transcript in batches, as if it was still being recorded
+  constexpr std::size_t batch_size = 100;
+  LiveFileSystem live;
+  for (std::size_t first = 0; first < input.size(); first += batch_size) {
+    auto last = std::min(first + batch_size, input.size());
+    live.apply({input.begin() + first, input.begin() + last});
+  }
 
-  part1(root);
-  part2(root);
+  auto used_space = live.fs().node(live.fs().root()).size;
+  fmt::print("The sum of dirs smaller than 100'000 (incremental): {}\n",
+             live.sum_small());
+  fmt::print("You need to delete a folder of size (incremental): {}\n",
+             live.smallest_dir(necessary_space - (total_space - used_space)));
 }
@@ -1,9 +1,15 @@
-#include <charconv>
-#include <cmath>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <queue>
 #include <string>
-#include <string_view>
-#include <variant>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #define FMT_HEADER_ONLY = 1
@@ -14,222 +20,712 @@
 
 #include "input.hpp"
 
-std::string getcol(const std::string &str, int col, int rows) {
-  return str | ranges::views::drop(col) | ranges::views::stride(rows + 1) |
-         ranges::to<std::string>;
-}
+int to_num(char c) { return static_cast<int>(c - '0'); }
 
-auto num_visible(std::string row) {
-  auto ints = row | ranges::views::transform([](auto c) { return c - '0'; });
-  auto tmp = ints | ranges::views::partial_sum([](auto x, auto y) {
-               return std::max(x, y);
-             }) |
-             ranges::views::unique | ranges::to<std::vector>;
-
-  auto first = row.begin();
-  // fmt::print("{}\n", tmp);
-  ranges::for_each(tmp, [&](auto x) {
-    auto it = ranges::find(first, row.end(), std::to_string(x)[0]);
-    if (it != row.end()) {
-      // fmt::print("distance from {}, to {}: {}\n", *first, *it,
-      //            ranges::distance(first, it));
-      ranges::transform(first, it, first, [](auto c) { return '?'; });
-      // fmt::print("{}\n", row);
-      first = it + 1;
-    }
-  });
-  // fmt::print("distance from beginning to first: {}\n", );
+/// Tree heights in row-major order
+struct Grid {
+  std::size_t rows;
+  std::size_t cols;
+  std::vector<std::uint8_t> heights;
 
-  return std::make_tuple(row, ranges::distance(row.begin(), first));
+  std::uint8_t operator()(std::size_t i, std::size_t j) const {
+    return heights[i * cols + j];
+  }
+};
+
+Grid parse_grid(const std::vector<std::string> &in) {
+  Grid grid{in.size(), in.empty() ? 0 : in.front().size(), {}};
+  grid.heights.reserve(grid.rows * grid.cols);
+  for (const auto &line : in) {
+    for (auto c : line) {
+      grid.heights.push_back(static_cast<std::uint8_t>(to_num(c)));
+    }
+  }
+  return grid;
 }
 
-int to_num(char c) { return static_cast<int>(c - '0'); }
+struct Forest {
+  std::size_t visible;
+  std::uint64_t best_scenic;
+};
 
-void part1() {
-  auto in = input();
+using Positions = std::array<std::uint32_t, 10>;
 
-  auto rows = in.size();
-  auto cols = in.front().size();
+// Closest position of a tree with at least height h, either before or after
+// the current tree in sweep order
+std::uint32_t closest_before(const Positions &last, std::uint8_t h) {
+  return *std::max_element(last.begin() + h, last.end());
+}
 
-  int counter = 0;
-  for (auto i = 1; i < rows - 1; ++i) {
-    for (auto j = 1; j < cols - 1; ++j) {
+std::uint32_t closest_after(const Positions &last, std::uint8_t h) {
+  return *std::min_element(last.begin() + h, last.end());
+}
 
-      // Is the tree at (i, j) visible from above
-      auto m = -1;
-      for (int k = 0; k < i; ++k) {
-        m = std::max(m, to_num(in[k][j]));
+/// West and east sweeps over the rows [first, last). Visibility is a running
+/// maximum, the viewing distance uses a table with the last position of each
+/// of the 10 heights: the closest blocking tree is the closest one of at least
+/// the same height.
+void sweep_rows(const Grid &grid, std::size_t first, std::size_t last,
+                std::vector<std::uint8_t> &visible,
+                std::vector<std::uint64_t> &scenic) {
+  const auto cols = grid.cols;
+
+  for (auto i = first; i < last; ++i) {
+    const auto row = i * cols;
+
+    int max = -1;
+    Positions seen;
+    seen.fill(0);
+    for (std::size_t j = 0; j < cols; ++j) {
+      auto h = grid.heights[row + j];
+      if (h > max) {
+        visible[row + j] = 1;
+        max = h;
       }
+      scenic[row + j] *= j - closest_before(seen, h);
+      seen[h] = static_cast<std::uint32_t>(j);
+    }
 
-      // Is the tree at (i, j) visible from below
-      auto n = -1;
-      for (int k = cols - 1; k > i; --k) {
-        n = std::max(n, to_num(in[k][j]));
+    max = -1;
+    seen.fill(static_cast<std::uint32_t>(cols - 1));
+    for (auto j = cols; j-- > 0;) {
+      auto h = grid.heights[row + j];
+      if (h > max) {
+        visible[row + j] = 1;
+        max = h;
       }
+      scenic[row + j] *= closest_after(seen, h) - j;
+      seen[h] = static_cast<std::uint32_t>(j);
+    }
+  }
+}
 
-      // Is the tree at (i, j) visible from below
-      auto w = -1;
-      for (int k = 0; k < j; ++k) {
-        w = std::max(w, to_num(in[i][k]));
+/// North and south sweeps over the columns [first, last). The state of each
+/// column is kept separately and the grid is walked row by row, such that the
+/// block of adjacent columns is read contiguously from every row.
+void sweep_columns(const Grid &grid, std::size_t first, std::size_t last,
+                   std::vector<std::uint8_t> &visible,
+                   std::vector<std::uint64_t> &scenic) {
+  const auto rows = grid.rows;
+  const auto cols = grid.cols;
+  const auto width = last - first;
+
+  std::vector<int> max(width);
+  std::vector<Positions> seen(width);
+
+  ranges::fill(max, -1);
+  for (auto &s : seen) {
+    s.fill(0);
+  }
+  for (std::size_t i = 0; i < rows; ++i) {
+    const auto row = i * cols + first;
+    for (std::size_t j = 0; j < width; ++j) {
+      auto h = grid.heights[row + j];
+      if (h > max[j]) {
+        visible[row + j] = 1;
+        max[j] = h;
       }
+      scenic[row + j] *= i - closest_before(seen[j], h);
+      seen[j][h] = static_cast<std::uint32_t>(i);
+    }
+  }
 
-      // Is the tree at (i, j) visible from below
-      auto e = -1;
-      for (int k = cols - 1; k > j; --k) {
-        e = std::max(e, to_num(in[i][k]));
+  ranges::fill(max, -1);
+  for (auto &s : seen) {
+    s.fill(static_cast<std::uint32_t>(rows - 1));
+  }
+  for (auto i = rows; i-- > 0;) {
+    const auto row = i * cols + first;
+    for (std::size_t j = 0; j < width; ++j) {
+      auto h = grid.heights[row + j];
+      if (h > max[j]) {
+        visible[row + j] = 1;
+        max[j] = h;
       }
-      // fmt::print("({}, {}): {} {} {} {}\n", i, j, n, m, e, w);
-      auto tmp = std::min(n, std::min(m, std::min(e, w)));
+      scenic[row + j] *= closest_after(seen[j], h) - i;
+      seen[j][h] = static_cast<std::uint32_t>(i);
+    }
+  }
+}
+
+/// Count the visible trees and find the best scenic score in O(rows * cols).
+Forest analyze(const Grid &grid) {
+  std::vector<std::uint8_t> visible(grid.rows * grid.cols, 0);
+  std::vector<std::uint64_t> scenic(grid.rows * grid.cols, 1);
+
+  sweep_rows(grid, 0, grid.rows, visible, scenic);
+  sweep_columns(grid, 0, grid.cols, visible, scenic);
+
+  return Forest{static_cast<std::size_t>(ranges::count(visible, 1)),
+                scenic.empty() ? 0 : ranges::max(scenic)};
+}
+
+/// Run fn(task) for all tasks in [0, num_tasks) on num_threads threads, each
+/// thread picks the next task until none are left
+void parallel_for(std::size_t num_tasks, std::size_t num_threads, auto fn) {
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&] {
+    for (auto task = next++; task < num_tasks; task = next++) {
+      fn(task);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+/// Same as analyze, but the sweeps are split into tasks for multiple threads.
+/// Row sweeps are split into bands of rows, column sweeps into blocks of
+/// adjacent columns, which keeps the per-column state in cache and uses every
+/// cache line loaded from a row fully. Each band then reports its count and
+/// maximum, which are merged into the global result.
+Forest parallel_analyze(
+    const Grid &grid,
+    std::size_t num_threads = std::thread::hardware_concurrency()) {
+  constexpr std::size_t band_rows = 64;
+  constexpr std::size_t block_cols = 512;
+
+  num_threads = std::max<std::size_t>(num_threads, 1);
+
+  std::vector<std::uint8_t> visible(grid.rows * grid.cols, 0);
+  std::vector<std::uint64_t> scenic(grid.rows * grid.cols, 1);
+
+  auto num_bands = (grid.rows + band_rows - 1) / band_rows;
+  auto num_blocks = (grid.cols + block_cols - 1) / block_cols;
+
+  parallel_for(num_bands, num_threads, [&](auto band) {
+    auto first = band * band_rows;
+    sweep_rows(grid, first, std::min(first + band_rows, grid.rows), visible,
+               scenic);
+  });
 
-      if (tmp < to_num(in[i][j])) {
-        ++counter;
+  parallel_for(num_blocks, num_threads, [&](auto block) {
+    auto first = block * block_cols;
+    sweep_columns(grid, first, std::min(first + block_cols, grid.cols),
+                  visible, scenic);
+  });
+
+  std::vector<Forest> bands(num_bands, Forest{0, 0});
+  parallel_for(num_bands, num_threads, [&](auto band) {
+    auto first = band * band_rows * grid.cols;
+    auto last = std::min((band + 1) * band_rows, grid.rows) * grid.cols;
+    for (auto k = first; k < last; ++k) {
+      bands[band].visible += visible[k];
+      bands[band].best_scenic = std::max(bands[band].best_scenic, scenic[k]);
+    }
+  });
+
+  return ranges::accumulate(bands, Forest{0, 0}, [](auto accum, auto band) {
+    return Forest{accum.visible + band.visible,
+                  std::max(accum.best_scenic, band.best_scenic)};
+  });
+}
+
+/// Heights packed into nibbles, halving the memory of Grid. Each row is split
+/// into groups of 32 columns stored in 16 bytes: byte k holds column k in the
+/// low and column k + 16 in the high nibble. Unpacking a group therefore
+/// yields two vectors of 16 consecutive columns without any shuffling. The
+/// last group of a row is padded with zeros. It's built directly from the
+/// input, so the unpacked grid is never needed.
+struct PackedGrid {
+  static constexpr std::size_t group_cols = 32;
+  static constexpr std::size_t group_bytes = 16;
+
+  std::size_t rows;
+  std::size_t cols;
+  std::size_t groups;
+  std::vector<std::uint8_t> data;
+
+  explicit PackedGrid(const std::vector<std::string> &in)
+      : rows(in.size()), cols(in.empty() ? 0 : in.front().size()),
+        groups((cols + group_cols - 1) / group_cols),
+        data(rows * groups * group_bytes, 0) {
+    for (std::size_t i = 0; i < rows; ++i) {
+      for (std::size_t j = 0; j < cols; ++j) {
+        auto k = j % group_cols;
+        auto &byte = data[(i * groups + j / group_cols) * group_bytes +
+                          k % group_bytes];
+        byte |= to_num(in[i][j]) << (k < group_bytes ? 0 : 4);
       }
     }
   }
 
-  fmt::print("{}\n", counter + (rows * 2) + (cols - 2) * 2);
+  std::uint8_t operator()(std::size_t i, std::size_t j) const {
+    auto k = j % group_cols;
+    auto byte =
+        data[(i * groups + j / group_cols) * group_bytes + k % group_bytes];
+    return k < group_bytes ? byte & 0xF : byte >> 4;
+  }
+};
+
+/// Vector of 16 bytes, the compiler maps operations on it to SSE/NEON
+/// instructions, or merges pairs of them into AVX2 ones where available
+typedef std::uint8_t u8x16 __attribute__((vector_size(16)));
+
+/// One bit per lane of a comparison result, lane k ends up in bit k
+std::uint32_t to_bits(u8x16 mask) {
+  std::uint32_t bits = 0;
+  for (std::size_t k = 0; k < 16; ++k) {
+    bits |= std::uint32_t{mask[k] & 1u} << k;
+  }
+  return bits;
 }
 
-int main() {
-  auto in = input();
+/// Mark the trees visible from north and south. Every step processes a group
+/// of 32 columns of one row at once: the running maximum and the comparison
+/// against it are plain vector operations. Heights are offset by one, so a
+/// running maximum of 0 means no tree was seen yet. `visible` has one bit per
+/// cell, a 32-bit word for each group, bit k for column k of the group.
+void vertical_visibility(const PackedGrid &grid,
+                         std::vector<std::uint32_t> &visible) {
+  auto step = [&](std::size_t i, std::size_t g, u8x16 &max_lo,
+                  u8x16 &max_hi) {
+    u8x16 packed;
+    std::memcpy(&packed,
+                &grid.data[(i * grid.groups + g) * PackedGrid::group_bytes],
+                sizeof(packed));
+
+    u8x16 lo = (packed & 0xF) + 1;
+    u8x16 hi = (packed >> 4) + 1;
+
+    visible[i * grid.groups + g] |=
+        to_bits((u8x16)(lo > max_lo)) | (to_bits((u8x16)(hi > max_hi)) << 16);
+    max_lo = lo > max_lo ? lo : max_lo;
+    max_hi = hi > max_hi ? hi : max_hi;
+  };
+
+  for (std::size_t g = 0; g < grid.groups; ++g) {
+    u8x16 max_lo = {};
+    u8x16 max_hi = {};
+    for (std::size_t i = 0; i < grid.rows; ++i) {
+      step(i, g, max_lo, max_hi);
+    }
 
-  auto rows = in.size();
-  auto cols = in.front().size();
-
-  int counter = 0;
-  for (auto i = 1; i < rows - 1; ++i) {
-    for (auto j = 1; j < cols - 1; ++j) {
-      auto cur = to_num(in[i][j]);
-      // Is the tree at (i, j) visible from above
-      int k = i - 1;
-      for (; k > 0; --k) {
-        auto c = to_num(in[k][j]);
-        if (c >= cur) {
-          break;
-        }
+    max_lo = u8x16{};
+    max_hi = u8x16{};
+    for (auto i = grid.rows; i-- > 0;) {
+      step(i, g, max_lo, max_hi);
+    }
+  }
+}
+
+/// Count the visible trees of the packed grid, the vertical directions use the
+/// vector kernel, the horizontal ones a running maximum along each row. The
+/// visibility is kept as bits, an eighth of the memory of the packed grid.
+std::size_t count_visible(const PackedGrid &grid) {
+  std::vector<std::uint32_t> visible(grid.rows * grid.groups, 0);
+
+  vertical_visibility(grid, visible);
+
+  // The padding of the last group is visible from north and south
+  auto tail = grid.cols % PackedGrid::group_cols;
+  auto last_group =
+      tail == 0 ? ~std::uint32_t{0} : (std::uint32_t{1} << tail) - 1;
+
+  std::size_t counter = 0;
+  for (std::size_t i = 0; i < grid.rows; ++i) {
+    auto *row = &visible[i * grid.groups];
+    auto mark = [&](std::size_t j) {
+      row[j / PackedGrid::group_cols] |=
+          std::uint32_t{1} << (j % PackedGrid::group_cols);
+    };
+
+    int max = -1;
+    for (std::size_t j = 0; j < grid.cols; ++j) {
+      int h = grid(i, j);
+      if (h > max) {
+        mark(j);
+        max = h;
+      }
+    }
+
+    max = -1;
+    for (auto j = grid.cols; j-- > 0;) {
+      int h = grid(i, j);
+      if (h > max) {
+        mark(j);
+        max = h;
       }
+    }
 
-      auto nd = k == 0 ? i : i - k;
+    if (grid.groups > 0) {
+      row[grid.groups - 1] &= last_group;
+    }
+    for (std::size_t g = 0; g < grid.groups; ++g) {
+      counter += static_cast<std::size_t>(std::popcount(row[g]));
+    }
+  }
+  return counter;
+}
 
-      // Is the tree at (i, j) visible from below
-      k = i + 1;
-      for (; k < rows; ++k) {
-        auto c = to_num(in[k][j]);
-        if (c >= cur) {
-          break;
+enum class Direction { North, South, West, East };
+
+/// Sparse table over a set of lines of equal length: level k holds the maximum
+/// of each window of 2^k values of a line, so the maximum of any range is the
+/// maximum of two overlapping windows, in O(1).
+class LineMaxIndex {
+public:
+  LineMaxIndex(std::size_t lines, std::size_t length,
+               std::vector<std::uint8_t> values)
+      : length_(length) {
+    levels_.push_back(std::move(values));
+    for (std::size_t width = 2; width <= length; width *= 2) {
+      const auto &prev = levels_.back();
+      std::vector<std::uint8_t> level(lines * length, 0);
+      for (std::size_t l = 0; l < lines; ++l) {
+        auto line = l * length;
+        for (std::size_t i = 0; i + width <= length; ++i) {
+          level[line + i] =
+              std::max(prev[line + i], prev[line + i + width / 2]);
         }
       }
-      auto sd = k == rows ? (int)k - i - 1 : k - i;
-
-      // Is the tree at (i, j) visible from left
-      k = j - 1;
-      for (; k > 0; --k) {
-        auto c = to_num(in[i][k]);
-        if (c >= cur) {
-          break;
-        }
+      levels_.push_back(std::move(level));
+    }
+  }
+
+  /// Maximum of the values [first, last) of the line, requires first < last
+  std::uint8_t max(std::size_t line, std::size_t first,
+                   std::size_t last) const {
+    auto k = std::bit_width(last - first) - 1;
+    const auto &level = levels_[k];
+    return std::max(level[line * length_ + first],
+                    level[line * length_ + last - (std::size_t{1} << k)]);
+  }
+
+  std::size_t length() const { return length_; }
+
+private:
+  std::size_t length_;
+  std::vector<std::vector<std::uint8_t>> levels_;
+};
+
+/// Answers line of sight queries from arbitrary trees, based on one range
+/// maximum index over the rows and one over the columns of the grid. The grid
+/// has to outlive the index.
+class ForestIndex {
+public:
+  struct Query {
+    std::size_t i;
+    std::size_t j;
+    Direction dir;
+    std::size_t max_range = std::numeric_limits<std::size_t>::max();
+  };
+
+  explicit ForestIndex(const Grid &grid)
+      : grid_(grid), rows_(grid.rows, grid.cols, grid.heights),
+        cols_(grid.cols, grid.rows, transpose(grid)) {}
+
+  /// Whether the tree at (i, j) can be seen from the edge in direction dir
+  bool visible_from(std::size_t i, std::size_t j, Direction dir) const {
+    auto [index, line, pos] = locate(i, j, dir);
+    auto h = grid_(i, j);
+    if (towards_start(dir)) {
+      return pos == 0 || index.max(line, 0, pos) < h;
+    }
+    return pos + 1 == index.length() ||
+           index.max(line, pos + 1, index.length()) < h;
+  }
+
+  /// Number of trees visible from (i, j) looking into direction dir, counting
+  /// at most max_range trees. Binary search for the shortest range containing
+  /// a tree at least as high as the one at (i, j).
+  std::size_t viewing_distance(
+      std::size_t i, std::size_t j, Direction dir,
+      std::size_t max_range = std::numeric_limits<std::size_t>::max()) const {
+    auto [index, line, pos] = locate(i, j, dir);
+    auto h = grid_(i, j);
+
+    auto start = towards_start(dir);
+    auto range = std::min(start ? pos : index.length() - 1 - pos, max_range);
+    auto blocked = [&](std::size_t distance) {
+      return start ? index.max(line, pos - distance, pos) >= h
+                   : index.max(line, pos + 1, pos + 1 + distance) >= h;
+    };
+
+    if (range == 0 || !blocked(range)) {
+      return range;
+    }
+
+    std::size_t lo = 1;
+    std::size_t hi = range;
+    while (lo < hi) {
+      auto mid = lo + (hi - lo) / 2;
+      if (blocked(mid)) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return lo;
+  }
+
+  std::vector<std::uint8_t>
+  visible_from(const std::vector<Query> &queries,
+               std::size_t num_threads = std::thread::hardware_concurrency())
+      const {
+    std::vector<std::uint8_t> result(queries.size());
+    batch(queries.size(), num_threads, [&](auto k) {
+      const auto &q = queries[k];
+      result[k] = visible_from(q.i, q.j, q.dir);
+    });
+    return result;
+  }
+
+  std::vector<std::size_t> viewing_distance(
+      const std::vector<Query> &queries,
+      std::size_t num_threads = std::thread::hardware_concurrency()) const {
+    std::vector<std::size_t> result(queries.size());
+    batch(queries.size(), num_threads, [&](auto k) {
+      const auto &q = queries[k];
+      result[k] = viewing_distance(q.i, q.j, q.dir, q.max_range);
+    });
+    return result;
+  }
+
+private:
+  struct Location {
+    const LineMaxIndex &index;
+    std::size_t line;
+    std::size_t pos;
+  };
+
+  static bool towards_start(Direction dir) {
+    return dir == Direction::North || dir == Direction::West;
+  }
+
+  Location locate(std::size_t i, std::size_t j, Direction dir) const {
+    if (dir == Direction::West || dir == Direction::East) {
+      return {rows_, i, j};
+    }
+    return {cols_, j, i};
+  }
+
+  static std::vector<std::uint8_t> transpose(const Grid &grid) {
+    std::vector<std::uint8_t> t(grid.rows * grid.cols);
+    for (std::size_t i = 0; i < grid.rows; ++i) {
+      for (std::size_t j = 0; j < grid.cols; ++j) {
+        t[j * grid.rows + i] = grid(i, j);
+      }
+    }
+    return t;
+  }
+
+  /// Split the queries into chunks, which are answered in parallel
+  static void batch(std::size_t num_queries, std::size_t num_threads,
+                    auto fn) {
+    constexpr std::size_t chunk = 4096;
+    auto num_chunks = (num_queries + chunk - 1) / chunk;
+    if (num_chunks == 0) {
+      return;
+    }
+
+    num_threads = std::clamp<std::size_t>(num_threads, 1, num_chunks);
+    parallel_for(num_chunks, num_threads, [&](auto c) {
+      auto last = std::min((c + 1) * chunk, num_queries);
+      for (auto k = c * chunk; k < last; ++k) {
+        fn(k);
+      }
+    });
+  }
+
+  const Grid &grid_;
+  LineMaxIndex rows_;
+  LineMaxIndex cols_;
+};
+
+/// Keeps the number of visible trees and the best scenic score up to date while
+/// single tree heights change. A tree only affects the trees in its own row
+/// and column, so an update sweeps these two lines again. For each tree the
+/// viewing distance and visibility per direction are stored, and the scenic
+/// scores are kept in a max-heap, where outdated entries are skipped lazily.
+class DynamicForest {
+public:
+  explicit DynamicForest(Grid grid)
+      : grid_(std::move(grid)), distances_(grid_.rows * grid_.cols),
+        visible_(grid_.rows * grid_.cols, 0) {
+    for (std::size_t i = 0; i < grid_.rows; ++i) {
+      sweep_row(i);
+    }
+    for (std::size_t j = 0; j < grid_.cols; ++j) {
+      sweep_col(j);
+    }
+
+    num_visible_ = static_cast<std::size_t>(
+        ranges::count_if(visible_, [](auto v) { return v != 0; }));
+    rebuild_scores();
+  }
+
+  const Grid &grid() const { return grid_; }
+
+  std::size_t visible() const { return num_visible_; }
+
+  std::uint64_t best_scenic() {
+    while (!scores_.empty() &&
+           scores_.top().first != score(scores_.top().second)) {
+      scores_.pop();
+    }
+    return scores_.empty() ? 0 : scores_.top().first;
+  }
+
+  void set_height(std::size_t i, std::size_t j, std::uint8_t height) {
+    auto affected = [&](auto fn) {
+      for (std::size_t k = 0; k < grid_.cols; ++k) {
+        fn(i * grid_.cols + k);
       }
-      auto ed = k == 0 ? j : j - k;
-
-      // Is the tree at (i, j) visible from right
-      k = j + 1;
-      for (; k < cols; ++k) {
-        auto c = to_num(in[i][k]);
-        if (c >= cur) {
-          break;
+      for (std::size_t k = 0; k < grid_.rows; ++k) {
+        if (k != i) {
+          fn(k * grid_.cols + j);
         }
       }
-      auto wd = k == rows ? (int)k - j - 1 : k - j;
+    };
+
+    affected([&](auto k) { num_visible_ -= visible_[k] != 0; });
+
+    grid_.heights[i * grid_.cols + j] = height;
+    sweep_row(i);
+    sweep_col(j);
+
+    affected([&](auto k) {
+      num_visible_ += visible_[k] != 0;
+      scores_.emplace(score(k), k);
+    });
 
-      counter = std::max(counter, nd * sd * ed * wd);
-      // fmt::print("({}, {}) = {}: {}\n", i, j, cur, nd * sd * ed * wd);
-      // auto tmp = std::min(n, std::min(m, std::min(e, w)));
-      //
-      // if (tmp < to_num(in[i][j])) {
-      //   ++counter;
-      // }
+    // Don't let the outdated entries pile up
+    if (scores_.size() > 4 * visible_.size()) {
+      rebuild_scores();
     }
   }
 
-  // fmt::print("{}\n", rows + rows + cols - 2 + cols - 2);
-  // fmt::print("{}\n", counter + (rows * 2) + (cols - 2) * 2);
-  fmt::print("{}\n", counter);
-  fmt::print("\n");
+private:
+  using Distances = std::array<std::uint32_t, 4>;
+  // Scenic score and index of the tree
+  using Score = std::pair<std::uint64_t, std::size_t>;
 
-  // for (auto i : in) {
-  //   fmt::print("{}\n", i);
-  // }
+  std::uint64_t score(std::size_t k) const {
+    const auto &d = distances_[k];
+    return std::uint64_t{d[0]} * d[1] * d[2] * d[3];
+  }
+
+  void rebuild_scores() {
+    std::vector<Score> scores;
+    scores.reserve(distances_.size());
+    for (std::size_t k = 0; k < distances_.size(); ++k) {
+      scores.emplace_back(score(k), k);
+    }
+    scores_ = std::priority_queue<Score>({}, std::move(scores));
+  }
+
+  void sweep_row(std::size_t i) {
+    sweep_line(i * grid_.cols, 1, grid_.cols, Direction::West,
+               Direction::East);
+  }
+
+  void sweep_col(std::size_t j) {
+    sweep_line(j, grid_.cols, grid_.rows, Direction::North, Direction::South);
+  }
+
+  /// Running maximum and last seen positions over one row or column, with
+  /// cells first + n * step for n in [0, length)
+  void sweep_line(std::size_t first, std::size_t step, std::size_t length,
+                  Direction before, Direction after) {
+    const auto bit_before = 1 << static_cast<int>(before);
+    const auto bit_after = 1 << static_cast<int>(after);
+
+    int max = -1;
+    Positions seen;
+    seen.fill(0);
+    for (std::size_t n = 0; n < length; ++n) {
+      auto k = first + n * step;
+      auto h = grid_.heights[k];
+      visible_[k] = h > max ? visible_[k] | bit_before
+                            : visible_[k] & ~bit_before;
+      max = std::max<int>(max, h);
+      distances_[k][static_cast<int>(before)] =
+          static_cast<std::uint32_t>(n - closest_before(seen, h));
+      seen[h] = static_cast<std::uint32_t>(n);
+    }
+
+    max = -1;
+    seen.fill(static_cast<std::uint32_t>(length - 1));
+    for (auto n = length; n-- > 0;) {
+      auto k = first + n * step;
+      auto h = grid_.heights[k];
+      visible_[k] = h > max ? visible_[k] | bit_after
+                            : visible_[k] & ~bit_after;
+      max = std::max<int>(max, h);
+      distances_[k][static_cast<int>(after)] =
+          static_cast<std::uint32_t>(closest_after(seen, h) - n);
+      seen[h] = static_cast<std::uint32_t>(n);
+    }
+  }
+
+  Grid grid_;
+  std::vector<Distances> distances_;
+  // One bit per direction, from which the tree is visible
+  std::vector<std::uint8_t> visible_;
+  std::size_t num_visible_ = 0;
+  std::priority_queue<Score> scores_;
+};
+
+void part1(const Forest &forest) {
+  fmt::print("Number of visible trees: {}\n", forest.visible);
+}
+
+void part2(const Forest &forest) {
+  fmt::print("Highest scenic score: {}\n", forest.best_scenic);
 }
-/*
+
 int main() {
   auto in = input();
-  auto instr = in | ranges::views::join('\n') | ranges::to<std::string>();
-  int rows = in.size();
-  int cols = in.front().size();
-
-  auto copy = instr;
-
-  copy = std::move(copy) | ranges::actions::transform([](auto x) {
-           if (x == '\n') {
-             return x;
-           } else {
-             return '?';
-           }
-         });
-  // Copy corners
-  copy[0] = instr[0];
-  copy[rows -1] = instr[rows - 1];
-  copy[(rows - 1) * cols] = instr[(rows - 1) * cols];
-  copy[rows * cols] = instr[rows * cols];
-
-  // for (int i = 1; i < rows - 1; ++i) {
-  //   auto row = in[i];
-  //   auto [tmp1, it1] = num_visible(row);
-  //
-  //   auto rowfirst = copy.begin() + i * (rows + 1);
-  //   auto rowlast = copy.begin() + i * (rows + 1) + rows;
-  //   std::copy(tmp1.begin(), tmp1.begin() + it1, rowfirst);
-  //
-  //   auto [tmp2, it2] =
-  //       num_visible(row | ranges::views::reverse | ranges::to<std::string>);
-  //
-  //   std::copy(tmp2.begin(), tmp2.begin() + it2,
-  //             std::make_reverse_iterator(rowlast));
-  // }
-
-  // fmt::print("{}\n\n", copy);
-
-  // for (int i = 1; i < cols - 1; ++i) {
-  //   std::string col = getcol(instr, i, rows);
-  //   auto [tmp1, it1] = num_visible(col);
-  //
-  //   for (auto [i, j] :
-  //        ranges::views::ints(0, rows * cols) | ranges::views::drop(i) |
-  //            ranges::views::stride(rows + 1) | ranges::views::take(it1) |
-  //            ranges::views::enumerate) {
-  //     copy[j] = *(tmp1.begin() + i);
-  //   }
-  //
-  //   auto [tmp2, it2] =
-  //       num_visible(col | ranges::views::reverse | ranges::to<std::string>);
-  //
-  //   for (auto [ii, jj] :
-  //        ranges::views::ints(0, rows * cols + i) | ranges::views::reverse |
-  //            ranges::views::stride(rows + 1) | ranges::views::take(it2) |
-  //            ranges::views::enumerate) {
-  //     // fmt::print("{}, {}\n", ii, jj);
-  //     copy[jj] = *(tmp1.begin() + ii);
-  //   }
-  // }
-
-  fmt::print("{}\n", copy);
-  auto visible =
-      ranges::count_if(copy, [](auto c) { return c >= '0' && c <= '9'; });
-  fmt::print("{}\n", visible);
-
-  // fmt::print("{}\n", instr);
-  // fmt::print("{}, {}\n", visible_rows, visible_cols);
-  // fmt::print("{}\n", visible_rows + visible_cols + 4);
-}
+  auto grid = parse_grid(in);
+  auto forest = analyze(grid);
+
+  part1(forest);
+  part2(forest);
+
+  auto parallel = parallel_analyze(grid);
+  fmt::print("Visible trees and highest scenic score (parallel): {}, {}\n",
+             parallel.visible, parallel.best_scenic);
+  fmt::print("Number of visible trees (packed): {}\n",
+             count_visible(PackedGrid{in}));
+
+  // Ask the index about every tree in every direction
+  ForestIndex index(grid);
+  std::vector<ForestIndex::Query> queries;
+  for (std::size_t i = 0; i < grid.rows; ++i) {
+    for (std::size_t j = 0; j < grid.cols; ++j) {
+      for (auto dir : {Direction::North, Direction::South, Direction::West,
+                       Direction::East}) {
+        queries.push_back({i, j, dir});
+      }
+    }
+  }
 
-*/
+  auto visible = index.visible_from(queries);
+  auto distances = index.viewing_distance(queries);
+
+  std::size_t num_visible = 0;
+  std::size_t best_scenic = 0;
+  for (std::size_t k = 0; k < queries.size(); k += 4) {
+    num_visible += visible[k] || visible[k + 1] || visible[k + 2] ||
+                   visible[k + 3];
+    best_scenic = std::max(best_scenic, distances[k] * distances[k + 1] *
+                                            distances[k + 2] *
+                                            distances[k + 3]);
+  }
+  fmt::print("Visible trees and highest scenic score (index): {}, {}\n",
+             num_visible, best_scenic);
+
+  // Let the tree in the middle grow to the maximum height
+  DynamicForest dynamic(grid);
+  dynamic.set_height(grid.rows / 2, grid.cols / 2, 9);
+  fmt::print("Visible trees and highest scenic score after growing the center "
+             "tree: {}, {}\n",
+             dynamic.visible(), dynamic.best_scenic());
+}
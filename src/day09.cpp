@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <charconv>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -80,8 +89,94 @@ auto move_close_to(Index tail, Index head) {
   return tail;
 }
 
+/// Smallest box containing all positions of the head, which also contains
+/// every other knot: all knots start at the origin, where the head starts as
+/// well, and a knot only ever moves towards its predecessor.
+struct BoundingBox {
+  Index min;
+  Index max;
+};
+
+BoundingBox head_bounds(const std::vector<Direction> &dirs) {
+  Index head{0, 0};
+  BoundingBox box{head, head};
+
+  for (auto d : dirs) {
+    std::visit(overloaded{[&](Right r) { head.first += r.distance; },
+                          [&](Left l) { head.first -= l.distance; },
+                          [&](Up u) { head.second += u.distance; },
+                          [&](Down d) { head.second -= d.distance; },
+                          [](std::monostate) {}},
+               d);
+    box.min = {std::min(box.min.first, head.first),
+               std::min(box.min.second, head.second)};
+    box.max = {std::max(box.max.first, head.first),
+               std::max(box.max.second, head.second)};
+  }
+  return box;
+}
+
+/// Set of visited positions inside of a bounding box. Usually it's a flat
+/// bitset over the whole box, if the box is too large, it's split into tiles of
+/// 64x64 positions, which are only allocated once something in them is
+/// visited. Sets which are used together can share the budget of the flat
+/// bitset by passing a part of it.
+class VisitedSet {
+public:
+  // Up to 128 MiB for the flat bitset
+  static constexpr std::int64_t max_dense_bits = std::int64_t{1} << 30;
+
+  explicit VisitedSet(BoundingBox box, std::int64_t dense_bits = max_dense_bits)
+      : box_(box) {
+    width_ = std::int64_t{box.max.first} - box.min.first + 1;
+    auto height = std::int64_t{box.max.second} - box.min.second + 1;
+
+    if (width_ * height <= dense_bits) {
+      bits_.resize(static_cast<std::size_t>((width_ * height + 63) / 64), 0);
+    } else {
+      dense_ = false;
+    }
+  }
+
+  void insert(Index idx) {
+    auto x = std::int64_t{idx.first} - box_.min.first;
+    auto y = std::int64_t{idx.second} - box_.min.second;
+
+    if (dense_) {
+      auto bit = static_cast<std::uint64_t>(y * width_ + x);
+      bits_[bit / 64] |= std::uint64_t{1} << (bit % 64);
+    } else {
+      auto key = (static_cast<std::uint64_t>(y / 64) << 32) |
+                 static_cast<std::uint64_t>(x / 64);
+      tiles_[key][y % 64] |= std::uint64_t{1} << (x % 64);
+    }
+  }
+
+  std::size_t count() const {
+    std::size_t counter = 0;
+    for (auto word : bits_) {
+      counter += std::popcount(word);
+    }
+    for (const auto &[key, tile] : tiles_) {
+      for (auto word : tile) {
+        counter += std::popcount(word);
+      }
+    }
+    return counter;
+  }
+
+private:
+  using Tile = std::array<std::uint64_t, 64>;
+
+  BoundingBox box_;
+  std::int64_t width_;
+  bool dense_ = true;
+  std::vector<std::uint64_t> bits_;
+  std::unordered_map<std::uint64_t, Tile> tiles_;
+};
+
 int count_tail_positions(const std::vector<Direction> &dirs, int num_knots) {
-  std::map<Index, int> counter;
+  VisitedSet visited(head_bounds(dirs));
   std::vector<Index> knots(num_knots, {0, 0});
 
   for (auto d : dirs) {
@@ -98,29 +193,454 @@ int count_tail_positions(const std::vector<Direction> &dirs, int num_knots) {
           knots[i] = move_close_to(knots[i], knots[i - 1]);
         }
       }
-      counter[knots.back()] = 1;
+      visited.insert(knots.back());
+    }
+  }
+
+  return static_cast<int>(visited.count());
+}
+
+/// Simulate a rope of N knots once and count the positions visited by every
+/// knot. Knot i follows the same path as the tail of a rope with i + 1 knots,
+/// so the i-th entry is the answer for i + 1 knots. As soon as a knot doesn't
+/// move, none of the following ones does, so the step ends there.
+template <std::size_t N>
+std::array<std::size_t, N>
+count_all_tail_positions(const std::vector<Direction> &dirs) {
+  auto box = head_bounds(dirs);
+
+  std::array<Index, N> knots;
+  knots.fill({0, 0});
+
+  // All sets together stay within the budget of a single flat bitset, larger
+  // boxes fall back to tiles
+  std::vector<VisitedSet> visited;
+  visited.reserve(N);
+  for ([[maybe_unused]] auto i : ranges::views::ints(0ul, N)) {
+    visited.emplace_back(box, VisitedSet::max_dense_bits / std::int64_t{N});
+  }
+
+  // The followers are still at the start after the first step, the head only
+  // counts the start if it returns there
+  for (std::size_t i = 1; i < N; ++i) {
+    visited[i].insert({0, 0});
+  }
+
+  for (auto d : dirs) {
+    auto distance =
+        std::visit(overloaded{[](std::monostate) { return 0; },
+                              [](auto dir) { return dir.distance; }},
+                   d);
+
+    for ([[maybe_unused]] auto j : ranges::views::ints(0, distance)) {
+      knots.front() = move_once(d, knots.front());
+      visited.front().insert(knots.front());
+
+      for (std::size_t i = 1; i < N; ++i) {
+        if (istouching(knots[i - 1], knots[i])) {
+          break;
+        }
+        knots[i] = move_close_to(knots[i], knots[i - 1]);
+        visited[i].insert(knots[i]);
+      }
+    }
+  }
+
+  std::array<std::size_t, N> counts;
+  for (std::size_t i = 0; i < N; ++i) {
+    counts[i] = visited[i].count();
+  }
+  return counts;
+}
+
+/// Lock-free single producer, single consumer ring buffer. The producer only
+/// writes the tail and the consumer only the head, both push and pop move
+/// whole batches at once.
+template <class T> class SpscRing {
+public:
+  /// The capacity is rounded up to a power of 2
+  explicit SpscRing(std::size_t capacity)
+      : buffer_(std::bit_ceil(capacity)), mask_(buffer_.size() - 1) {}
+
+  /// Push as many of the n elements as fit, returns how many were pushed
+  std::size_t push(const T *data, std::size_t n) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    n = std::min(n, buffer_.size() - (tail - head));
+    for (std::size_t i = 0; i < n; ++i) {
+      buffer_[(tail + i) & mask_] = data[i];
+    }
+    tail_.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  /// Pop up to n elements, returns how many were popped
+  std::size_t pop(T *out, std::size_t n) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_acquire);
+    n = std::min(n, tail - head);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = buffer_[(head + i) & mask_];
+    }
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  /// Called by the producer after the last push
+  void close() { closed_.store(true, std::memory_order_release); }
+
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+  std::vector<T> buffer_;
+  std::size_t mask_;
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+  std::atomic<bool> closed_ = false;
+};
+
+/// Same as count_tail_positions, but the knots are split into groups, each of
+/// which runs on its own thread. A knot only depends on the path of its
+/// predecessor, so every group consumes the positions of the last knot of the
+/// previous group from a ring buffer, and forwards the positions of its own
+/// last knot to the next group. Only actual moves are forwarded, a knot never
+/// moves if its predecessor doesn't. The group with the tail records the
+/// visited positions.
+int count_tail_positions_pipelined(const std::vector<Direction> &dirs,
+                                   int num_knots, int num_stages) {
+  constexpr std::size_t batch_size = 1024;
+  constexpr std::size_t ring_size = 16 * batch_size;
+
+  // Nothing to pipeline without any knot following the head
+  if (num_knots < 2) {
+    return count_tail_positions(dirs, num_knots);
+  }
+
+  // The head is driven by the directions, all other knots are split up
+  auto followers = static_cast<std::size_t>(num_knots - 1);
+  auto stages = std::clamp<std::size_t>(num_stages, 1, followers);
+
+  std::vector<std::unique_ptr<SpscRing<Index>>> rings;
+  for ([[maybe_unused]] auto i : ranges::views::ints(1ul, stages)) {
+    rings.push_back(std::make_unique<SpscRing<Index>>(ring_size));
+  }
+
+  VisitedSet visited(head_bounds(dirs));
+  visited.insert({0, 0});
+
+  auto stage = [&](std::size_t s) {
+    auto first = s * followers / stages;
+    auto last = (s + 1) * followers / stages;
+    std::vector<Index> knots(last - first, {0, 0});
+    auto *in = s == 0 ? nullptr : rings[s - 1].get();
+    auto *out = s + 1 == stages ? nullptr : rings[s].get();
+
+    std::vector<Index> batch;
+    batch.reserve(batch_size);
+
+    auto flush = [&] {
+      for (std::size_t pushed = 0; pushed < batch.size();) {
+        auto n = out->push(batch.data() + pushed, batch.size() - pushed);
+        if (n == 0) {
+          std::this_thread::yield();
+        }
+        pushed += n;
+      }
+      batch.clear();
+    };
+
+    auto follow = [&](Index leader) {
+      for (auto &knot : knots) {
+        if (istouching(leader, knot)) {
+          return;
+        }
+        knot = move_close_to(knot, leader);
+        leader = knot;
+      }
+
+      if (out == nullptr) {
+        visited.insert(knots.back());
+      } else {
+        batch.push_back(knots.back());
+        if (batch.size() == batch_size) {
+          flush();
+        }
+      }
+    };
+
+    if (in == nullptr) {
+      Index head{0, 0};
+      for (auto d : dirs) {
+        auto distance =
+            std::visit(overloaded{[](std::monostate) { return 0; },
+                                  [](auto dir) { return dir.distance; }},
+                       d);
+        for ([[maybe_unused]] auto j : ranges::views::ints(0, distance)) {
+          head = move_once(d, head);
+          follow(head);
+        }
+      }
+    } else {
+      std::array<Index, batch_size> received;
+      while (true) {
+        auto n = in->pop(received.data(), received.size());
+        if (n == 0) {
+          // Everything pushed before closing is visible after seeing closed
+          if (!in->closed()) {
+            std::this_thread::yield();
+            continue;
+          }
+          n = in->pop(received.data(), received.size());
+          if (n == 0) {
+            break;
+          }
+        }
+        for (auto leader : received | ranges::views::take(n)) {
+          follow(leader);
+        }
+      }
+    }
+
+    if (out != nullptr) {
+      flush();
+      out->close();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (auto s : ranges::views::ints(0ul, stages)) {
+    threads.emplace_back(stage, s);
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  return static_cast<int>(visited.count());
+}
+
+/// Set of visited positions stored as horizontal and vertical segments, such
+/// that a long straight path is inserted in O(1). Single positions are
+/// horizontal segments of length 1. The number of distinct positions is the
+/// size of the merged horizontal segments plus the size of the merged vertical
+/// segments, minus the number of crossings between them. Whenever a list of
+/// segments doubled in size since it was last merged, it is merged again, so
+/// revisited positions and adjacent steps don't grow the memory with the
+/// number of steps.
+class SegmentSet {
+public:
+  void insert(Index idx) {
+    add(horizontal_, {idx.second, idx.first, idx.first});
+  }
+
+  /// Insert all positions from a to b, which have to be on a line
+  void insert_segment(Index a, Index b) {
+    if (a.second == b.second) {
+      add(horizontal_, {a.second, std::min(a.first, b.first),
+                        std::max(a.first, b.first)});
+    } else {
+      add(vertical_, {a.first, std::min(a.second, b.second),
+                      std::max(a.second, b.second)});
+    }
+  }
+
+  std::size_t count() const {
+    auto horizontal = merge(horizontal_.segments);
+    auto vertical = merge(vertical_.segments);
+
+    std::size_t counter = 0;
+    for (const auto &seg : horizontal) {
+      counter += seg.hi - seg.lo + 1;
+    }
+    for (const auto &seg : vertical) {
+      counter += seg.hi - seg.lo + 1;
+    }
+    return counter - crossings(horizontal, vertical);
+  }
+
+private:
+  /// All positions with the coordinate `line` along the segment, and the other
+  /// one from lo to hi
+  struct Segment {
+    int line;
+    int lo;
+    int hi;
+  };
+
+  struct Segments {
+    std::vector<Segment> segments;
+    // Size after which the segments are merged again
+    std::size_t merge_at = 1024;
+  };
+
+  static void add(Segments &segs, Segment seg) {
+    segs.segments.push_back(seg);
+    if (segs.segments.size() >= segs.merge_at) {
+      segs.segments = merge(std::move(segs.segments));
+      segs.merge_at = std::max<std::size_t>(2 * segs.segments.size(), 1024);
+    }
+  }
+
+  static std::vector<Segment> merge(std::vector<Segment> segments) {
+    ranges::sort(segments, [](const auto &a, const auto &b) {
+      return std::tie(a.line, a.lo) < std::tie(b.line, b.lo);
+    });
+
+    std::vector<Segment> merged;
+    for (const auto &seg : segments) {
+      if (!merged.empty() && merged.back().line == seg.line &&
+          std::int64_t{seg.lo} <= std::int64_t{merged.back().hi} + 1) {
+        merged.back().hi = std::max(merged.back().hi, seg.hi);
+      } else {
+        merged.push_back(seg);
+      }
+    }
+    return merged;
+  }
+
+  /// Count the positions on both a horizontal and a vertical segment, by
+  /// sweeping along x and keeping the horizontal segments at the current x in
+  /// a Fenwick tree over their (compressed) y coordinates
+  static std::size_t crossings(const std::vector<Segment> &horizontal,
+                               const std::vector<Segment> &vertical) {
+    std::vector<int> ys;
+    ys.reserve(horizontal.size());
+    for (const auto &seg : horizontal) {
+      ys.push_back(seg.line);
+    }
+    ranges::sort(ys);
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    // Events at the same x: horizontal segments start (0) and end (1) before
+    // the vertical segments (2) are queried
+    struct Event {
+      std::int64_t x;
+      int kind;
+      const Segment *seg;
+    };
+
+    std::vector<Event> events;
+    events.reserve(2 * horizontal.size() + vertical.size());
+    for (const auto &seg : horizontal) {
+      events.push_back({seg.lo, 0, &seg});
+      events.push_back({std::int64_t{seg.hi} + 1, 1, &seg});
+    }
+    for (const auto &seg : vertical) {
+      events.push_back({seg.line, 2, &seg});
+    }
+    ranges::sort(events, [](const auto &a, const auto &b) {
+      return std::tie(a.x, a.kind) < std::tie(b.x, b.kind);
+    });
+
+    std::vector<std::int64_t> tree(ys.size() + 1, 0);
+    auto add = [&](int y, std::int64_t delta) {
+      auto i = ranges::lower_bound(ys, y) - ys.begin() + 1;
+      for (; i < static_cast<std::ptrdiff_t>(tree.size()); i += i & -i) {
+        tree[i] += delta;
+      }
+    };
+    // Number of active horizontal segments with y below the given one
+    auto below = [&](std::int64_t y) {
+      auto i = ranges::lower_bound(ys, y) - ys.begin();
+      std::int64_t sum = 0;
+      for (; i > 0; i -= i & -i) {
+        sum += tree[i];
+      }
+      return sum;
+    };
+
+    std::size_t counter = 0;
+    for (const auto &event : events) {
+      if (event.kind == 0) {
+        add(event.seg->line, 1);
+      } else if (event.kind == 1) {
+        add(event.seg->line, -1);
+      } else {
+        counter += static_cast<std::size_t>(
+            below(std::int64_t{event.seg->hi} + 1) - below(event.seg->lo));
+      }
+    }
+    return counter;
+  }
+
+  Segments horizontal_;
+  Segments vertical_;
+};
+
+/// Same as count_tail_positions, but long straight moves are skipped ahead.
+/// Once every knot is exactly one step behind its predecessor in the direction
+/// of the move, each further step moves all knots by one in that direction.
+/// The rest of the move is then applied at once, and the tail's path inserted
+/// as a single segment, so a move costs time depending on the number of knots,
+/// but not on its distance.
+int count_tail_positions_compressed(const std::vector<Direction> &dirs,
+                                    int num_knots) {
+  SegmentSet visited;
+  std::vector<Index> knots(num_knots, {0, 0});
+
+  for (auto d : dirs) {
+    auto distance =
+        std::visit(overloaded{[](std::monostate) { return 0; },
+                              [](auto dir) { return dir.distance; }},
+                   d);
+    auto step = move_once(d, {0, 0});
+
+    auto straight = [&] {
+      for (auto i : ranges::views::ints(1ul, knots.size())) {
+        if (knots[i].first + step.first != knots[i - 1].first ||
+            knots[i].second + step.second != knots[i - 1].second) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    for (auto remaining = distance; remaining > 0; --remaining) {
+      if (straight()) {
+        auto tail = knots.back();
+        for (auto &knot : knots) {
+          knot.first += remaining * step.first;
+          knot.second += remaining * step.second;
+        }
+        visited.insert_segment({tail.first + step.first,
+                                tail.second + step.second},
+                               knots.back());
+        break;
+      }
+
+      knots.front() = move_once(d, knots.front());
+      for (auto i : ranges::views::ints(1ul, knots.size())) {
+        if (!istouching(knots[i - 1], knots[i])) {
+          knots[i] = move_close_to(knots[i], knots[i - 1]);
+        }
+      }
+      visited.insert(knots.back());
     }
   }
 
-  return counter.size();
+  return static_cast<int>(visited.count());
 }
 
-void part1(const std::vector<Direction> &dirs) {
-  fmt::print("With 2 knots, the tail visits {} positions\n",
-             count_tail_positions(dirs, 2));
+void part1(const std::array<std::size_t, 10> &counts) {
+  fmt::print("With 2 knots, the tail visits {} positions\n", counts[1]);
 }
 
-void part2(const std::vector<Direction> &dirs) {
-  fmt::print("With 10 knots, the tail visits {} positions\n",
-             count_tail_positions(dirs, 10));
+void part2(const std::array<std::size_t, 10> &counts) {
+  fmt::print("With 10 knots, the tail visits {} positions\n", counts[9]);
 }
 
 int main() {
   auto in = input();
   auto dirs = to_directions(in);
 
-  part1(dirs);
-  part2(dirs);
+  // Simulate the longest rope once, shorter ropes follow the same path
+  auto counts = count_all_tail_positions<10>(dirs);
+
+  part1(counts);
+  part2(counts);
+  fmt::print("With 10 knots, the tail visits {} positions (pipelined)\n",
+             count_tail_positions_pipelined(dirs, 10, 3));
+  fmt::print("With 10 knots, the tail visits {} positions (compressed)\n",
+             count_tail_positions_compressed(dirs, 10));
 
   return 0;
 }
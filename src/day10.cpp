@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <array>
 #include <charconv>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <string_view>
 #include <variant>
+#include <utility>
 #include <vector>
 
 #define FMT_HEADER_ONLY = 1
@@ -45,140 +49,220 @@ struct Visitor {
   std::pair<int, int> operator()(Add a) const { return {a.inc, a.duration}; }
 };
 
-struct InfoVisitor {
-  void operator()(Noop noop) const {
-    fmt::print("Start Cycle {:>3}: Begin executing noop\n", clock);
-  }
-  void operator()(Add a) const {
-    fmt::print("Start Cycle {:>3}: Begin executing addx {}\n", clock, a.inc);
+/// Trace of the X register over the cycles of a program. The instructions are
+/// decoded into one increment per cycle, which is applied at the end of that
+/// cycle, and the prefix sum of them is the value of X during each cycle.
+class CpuTrace {
+public:
+  explicit CpuTrace(const std::vector<Instruction> &instrs) {
+    std::vector<std::int32_t> increments;
+    increments.reserve(2 * instrs.size());
+    for (auto instr : instrs) {
+      auto [inc, instr_time] = std::visit(Visitor{}, instr);
+      increments.insert(increments.end(), instr_time - 1, 0);
+      increments.push_back(inc);
+    }
+
+    // Index 0 is unused, cycles start at 1
+    x_.reserve(increments.size() + 2);
+    x_.push_back(1);
+    x_.push_back(1);
+    for (auto inc : increments) {
+      x_.push_back(x_.back() + inc);
+    }
   }
 
-  int clock;
-};
+  /// Number of cycles until the program is finished
+  std::size_t cycles() const { return x_.size() - 2; }
 
-struct EndInfoVisitor {
-  void operator()(Noop noop) const {
-    fmt::print("End Cycle {:>5}: Finish executing noop\n", clock);
+  /// The value of X during the given cycle, after the program is finished it
+  /// doesn't change anymore
+  std::int32_t x_during(std::size_t cycle) const {
+    return x_[std::min(cycle, x_.size() - 1)];
   }
-  void operator()(Add a) const {
-    fmt::print(
-        "End Cycle {:>5}: Finish executing addx {} (Register is now {})\n",
-        clock, a.inc, X);
+
+  std::int64_t signal_strength(const std::vector<std::size_t> &probes) const {
+    return ranges::accumulate(probes, std::int64_t{0},
+                              [this](auto sum, auto c) {
+                                return sum + static_cast<std::int64_t>(c) *
+                                                 x_during(c);
+                              });
   }
 
-  int clock;
-  int X;
+private:
+  std::vector<std::int32_t> x_;
 };
 
-auto part1(const std::vector<Instruction> &instrs) {
-  std::vector<int> strengths;
-
-  auto X = 1;
-  auto clock = 1;
-
-  for (auto instr : instrs) {
-    auto [inc, instr_time] = std::visit(Visitor{}, instr);
-
-    for ([[maybe_unused]] auto i : ranges::views::ints(0, instr_time)) {
-      ++clock;
+/// Traces of many programs, interleaved such that the values of X of all
+/// programs for one cycle are next to each other. Probing a cycle is then a
+/// loop over contiguous lanes, which the compiler vectorises.
+class CpuTraceBatch {
+public:
+  explicit CpuTraceBatch(const std::vector<std::vector<Instruction>> &programs)
+      : lanes_(programs.size()) {
+    std::vector<CpuTrace> traces;
+    traces.reserve(programs.size());
+    for (const auto &program : programs) {
+      traces.emplace_back(program);
+      cycles_ = std::max(cycles_, traces.back().cycles());
     }
 
-    // If the instruction time was 2, then we might jump from 19 to 21, and need
-    // to calculate the strength before adding the increment
-    if (instr_time == 2 && (clock == 21 || (clock - 20) % 40 == 1)) {
-      fmt::print("{}: {}, {}, {}\n", clock - 1, X, inc, (clock - 1) * X);
-      strengths.push_back((clock - 1) * X);
+    x_.resize((cycles_ + 2) * lanes_);
+    for (std::size_t c = 0; c < cycles_ + 2; ++c) {
+      for (std::size_t lane = 0; lane < lanes_; ++lane) {
+        x_[c * lanes_ + lane] = traces[lane].x_during(c);
+      }
     }
+  }
 
-    X += inc;
-
-    if (clock == 20 || (clock - 20) % 40 == 0) {
-      fmt::print("{}: {}, {}, {}\n", clock, X, inc, clock * X);
-      strengths.push_back(clock * X);
+  std::size_t lanes() const { return lanes_; }
+
+  /// Sum of cycle * X over all probed cycles, for every program
+  std::vector<std::int64_t>
+  signal_strengths(const std::vector<std::size_t> &probes) const {
+    std::vector<std::int64_t> sums(lanes_, 0);
+    for (auto c : probes) {
+      const auto *x = &x_[std::min(c, cycles_ + 1) * lanes_];
+      const auto cycle = static_cast<std::int64_t>(c);
+      for (std::size_t lane = 0; lane < lanes_; ++lane) {
+        sums[lane] += cycle * x[lane];
+      }
     }
+    return sums;
   }
-  fmt::print("{}\n", ranges::accumulate(strengths, 0));
-}
 
-void part2(const std::vector<Instruction> &instructions, bool verbose = false) {
-  auto X = 1;
-  auto clock = 1;
+private:
+  std::size_t lanes_;
+  std::size_t cycles_ = 0;
+  std::vector<std::int32_t> x_;
+};
 
-  auto print_sprite = [](auto X) {
-    std::string sprite_pos(40, '.');
-    if (X > 1) {
-      sprite_pos[X - 1] = '#';
-    }
-    if (X > 0 && X < 40) {
-      sprite_pos[X] = '#';
-    }
-    if (X < 39) {
-      sprite_pos[X + 1] = '#';
-    }
-    fmt::print("Sprite position: {}\n", sprite_pos);
-  };
+void part1(const CpuTrace &trace, const CpuTraceBatch &batch) {
+  // Every 40 cycles, starting at cycle 20
+  auto probes = ranges::views::iota(0ul, 6ul) |
+                ranges::views::transform([](auto i) { return 20 + 40 * i; }) |
+                ranges::to<std::vector>;
 
-  std::vector<std::string> rows;
-  std::string row = "";
-  for (auto instr : instructions) {
-    auto [inc, instr_time] = std::visit(Visitor{}, instr);
+  fmt::print("Sum of signal strengths: {}\n", trace.signal_strength(probes));
+  fmt::print("Sum of signal strengths (batch): {}\n",
+             batch.signal_strengths(probes));
+}
 
-    if (verbose) {
-      std::visit(InfoVisitor{clock}, instr);
+/// Letters of the CRT are 4 pixels wide and 6 pixels high, encoded with bit
+/// 4 * row + col set for each lit pixel
+constexpr std::uint32_t glyph(std::string_view pixels) {
+  std::uint32_t code = 0;
+  for (std::size_t i = 0; i < pixels.size(); ++i) {
+    if (pixels[i] == '#') {
+      code |= std::uint32_t{1} << i;
     }
+  }
+  return code;
+}
 
-    for (auto i : ranges::views::ints(0, instr_time)) {
-      auto curcol = ((clock - 1) % 40);
-
-      if (verbose) {
-        fmt::print(
-            "During Cycle {:>2}: CRT draws pixel in position {} (X = {})\n",
-            clock, curcol, X);
-      }
-
-      if (curcol == 0) {
-        rows.push_back(row);
-        row.clear();
+// clang-format off
+constexpr std::array<std::pair<std::uint32_t, char>, 18> glyphs{{
+    {glyph(".##." "#..#" "#..#" "####" "#..#" "#..#"), 'A'},
+    {glyph("###." "#..#" "###." "#..#" "#..#" "###."), 'B'},
+    {glyph(".##." "#..#" "#..." "#..." "#..#" ".##."), 'C'},
+    {glyph("####" "#..." "###." "#..." "#..." "####"), 'E'},
+    {glyph("####" "#..." "###." "#..." "#..." "#..."), 'F'},
+    {glyph(".##." "#..#" "#..." "#.##" "#..#" ".###"), 'G'},
+    {glyph("#..#" "#..#" "####" "#..#" "#..#" "#..#"), 'H'},
+    {glyph(".###" "..#." "..#." "..#." "..#." ".###"), 'I'},
+    {glyph("..##" "...#" "...#" "...#" "#..#" ".##."), 'J'},
+    {glyph("#..#" "#.#." "##.." "#.#." "#.#." "#..#"), 'K'},
+    {glyph("#..." "#..." "#..." "#..." "#..." "####"), 'L'},
+    {glyph(".##." "#..#" "#..#" "#..#" "#..#" ".##."), 'O'},
+    {glyph("###." "#..#" "#..#" "###." "#..." "#..."), 'P'},
+    {glyph("###." "#..#" "#..#" "###." "#.#." "#..#"), 'R'},
+    {glyph(".###" "#..." "#..." ".##." "...#" "###."), 'S'},
+    {glyph("#..#" "#..#" "#..#" "#..#" "#..#" ".##."), 'U'},
+    {glyph("#..." "#..." ".#.#" "..#." "..#." "..#."), 'Y'},
+    {glyph("####" "...#" "..#." ".#.." "#..." "####"), 'Z'},
+}};
+// clang-format on
+
+/// One frame of the CRT, each row of 40 pixels is stored as the lowest bits
+/// of an integer, with bit i for the pixel in column i
+class Framebuffer {
+public:
+  static constexpr std::size_t width = 40;
+  static constexpr std::size_t height = 6;
+  static constexpr std::size_t letters = width / 5;
+
+  /// Draw the given frame of the program, i.e. cycles
+  /// frame * 240 + 1 to (frame + 1) * 240
+  void render(const CpuTrace &trace, std::size_t frame = 0) {
+    auto cycle = frame * width * height + 1;
+    for (auto &row : rows_) {
+      row = 0;
+      for (std::size_t col = 0; col < width; ++col, ++cycle) {
+        row |= sprite(trace.x_during(cycle)) & (std::uint64_t{1} << col);
       }
+    }
+  }
 
-      if (curcol == X - 1 || curcol == X || curcol == X + 1) {
-        row.push_back('#');
-      } else {
-        row.push_back('.');
-      }
+  bool lit(std::size_t row, std::size_t col) const {
+    return (rows_[row] >> col) & 1;
+  }
 
-      if (verbose) {
-        fmt::print("Current CRT Row: {}\n", row);
+  /// Read the letters of the frame, each one is 4 pixels wide followed by one
+  /// column of spacing, unknown letters are returned as '?'
+  std::array<char, letters> decode() const {
+    std::array<char, letters> text;
+    for (std::size_t k = 0; k < letters; ++k) {
+      std::uint32_t code = 0;
+      for (std::size_t row = 0; row < height; ++row) {
+        code |= static_cast<std::uint32_t>((rows_[row] >> (5 * k)) & 0xF)
+                << (4 * row);
       }
-      ++clock;
 
-      if (verbose && i != instr_time - 1) {
-        fmt::print("\n");
-      }
+      auto it = ranges::find(glyphs, code, [](auto g) { return g.first; });
+      text[k] = it == glyphs.end() ? '?' : it->second;
     }
+    return text;
+  }
 
-    X += inc;
-
-    if (verbose) {
-      std::visit(EndInfoVisitor{clock, X}, instr);
-      print_sprite(X);
-      fmt::print("\n");
+private:
+  /// The sprite is 3 pixels wide and centered around X
+  static std::uint64_t sprite(std::int32_t x) {
+    if (x < -1 || x > static_cast<std::int32_t>(width)) {
+      return 0;
     }
+    auto mask = std::uint64_t{0b111} << (x + 1);
+    return (mask >> 2) & ((std::uint64_t{1} << width) - 1);
   }
 
-  rows.push_back(row);
+  std::array<std::uint64_t, height> rows_{};
+};
 
-  for (auto r : rows) {
-    fmt::print("{}\n", r);
+void part2(const CpuTrace &trace) {
+  Framebuffer screen;
+  screen.render(trace);
+
+  for (std::size_t row = 0; row < Framebuffer::height; ++row) {
+    for (std::size_t col = 0; col < Framebuffer::width; ++col) {
+      fmt::print("{}", screen.lit(row, col) ? '#' : '.');
+    }
+    fmt::print("\n");
   }
+
+  auto text = screen.decode();
+  fmt::print("Letters on the CRT: {}\n",
+             std::string_view(text.data(), text.size()));
 }
 
 int main() {
   auto in = input();
   auto instructions = parse(in);
 
-  part1(instructions);
-  part2(instructions);
+  CpuTrace trace(instructions);
+  // A batch with the input program as its only lane
+  CpuTraceBatch batch({instructions});
+
+  part1(trace, batch);
+  part2(trace);
 
   return 0;
 }
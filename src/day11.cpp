@@ -1,9 +1,19 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -258,29 +268,504 @@ void part1(std::vector<Monkey> monkeys) {
   fmt::print("monkey business: {}\n\n\n", top.first * top.second);
 }
 
-void part2(std::vector<Monkey> monkeys) {
-  auto supermodulo =
-      ranges::accumulate(monkeys, 1, std::multiplies{}, &Monkey::testarg);
+enum class OpCode : std::uint8_t { Add, Multiply, Square };
 
-  for (auto round : ranges::views::iota(1, 10001)) {
-    if (round % 1000 == 0) {
-      fmt::print("Round {}\n", round);
+/// Divisibility test by a fixed divisor for numbers and divisors below 2^32
+/// with a single multiplication (Lemire et al.): n is divisible exactly if the
+/// fractional part of n / divisor, scaled to 64 bit, is smaller than
+/// 2^64 / divisor.
+constexpr std::uint64_t divisibility_constant(std::uint64_t divisor) {
+  return std::numeric_limits<std::uint64_t>::max() / divisor + 1;
+}
+
+constexpr bool is_divisible(std::uint64_t n, std::uint64_t constant) {
+  return n * constant <= constant - 1;
+}
+
+/// Vector of four 64-bit lanes, the compiler maps operations on it to AVX2
+/// instructions where available, or to pairs of SSE/NEON ones
+typedef std::uint64_t u64x4 __attribute__((vector_size(32)));
+// Vectors are passed by reference, as passing them by value has a different
+// ABI with and without AVX
+
+/// Replace the lanes of a by the high 64 bit of the 128-bit products a * b.
+/// There is no vector instruction for it, so it's assembled from the four
+/// 32x32-bit products
+void mul_high(u64x4 &a, const u64x4 &b) {
+  constexpr std::uint64_t low = 0xFFFF'FFFF;
+  auto lo_lo = (a & low) * (b & low);
+  auto hi_lo = (a >> 32) * (b & low);
+  auto lo_hi = (a & low) * (b >> 32);
+  auto hi_hi = (a >> 32) * (b >> 32);
+
+  // At most 3 * (2^32 - 1) + (2^32 - 1)^2 < 2^64
+  auto cross = (lo_lo >> 32) + (hi_lo & low) + lo_hi;
+  a = hi_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+/// Divisibility test of each lane, bit k is set if lane k is divisible
+unsigned divisible_lanes(const u64x4 &n, std::uint64_t constant) {
+  auto result = n * constant <= constant - 1;
+  return static_cast<unsigned>((result[0] & 1) | (result[1] & 2) |
+                               (result[2] & 4) | (result[3] & 8));
+}
+
+/// Shuffle indices which move the lanes selected by a 4-bit mask to the front,
+/// in their original order
+const std::array<u64x4, 16> compress_table = [] {
+  std::array<u64x4, 16> table{};
+  for (unsigned mask = 0; mask < 16; ++mask) {
+    std::size_t n = 0;
+    for (unsigned lane = 0; lane < 4; ++lane) {
+      if ((mask >> lane) & 1) {
+        table[mask][n++] = lane;
+      }
+    }
+  }
+  return table;
+}();
+
+/// Remainder of the division by a fixed divisor without dividing (Barrett
+/// reduction). The quotient estimated with the truncated reciprocal is at most
+/// two too small, which two conditional subtractions correct.
+class FastMod {
+public:
+  explicit FastMod(std::uint64_t divisor = 1)
+      : divisor_(divisor),
+        reciprocal_(std::numeric_limits<std::uint64_t>::max() / divisor) {}
+
+  std::uint64_t operator()(std::uint64_t x) const {
+    auto quotient =
+        static_cast<std::uint64_t>((uint128_t{x} * reciprocal_) >> 64);
+    auto r = x - quotient * divisor_;
+    r -= r >= divisor_ ? divisor_ : 0;
+    r -= r >= divisor_ ? divisor_ : 0;
+    return r;
+  }
+
+  /// Reduce every lane of x in place
+  void reduce(u64x4 &x) const {
+    u64x4 divisor = u64x4{} + divisor_;
+    u64x4 quotient = x;
+    mul_high(quotient, u64x4{} + reciprocal_);
+    x -= quotient * divisor_;
+    x -= (u64x4)(x >= divisor) & divisor;
+    x -= (u64x4)(x >= divisor) & divisor;
+  }
+
+private:
+  std::uint64_t divisor_;
+  std::uint64_t reciprocal_;
+};
+
+/// Simulates the monkeys with their worry levels kept below the product of all
+/// test divisors. All monkeys are stored as structure of arrays, the operation
+/// is an opcode with an operand instead of a std::function, and each monkey
+/// holds its items in a ring buffer large enough for all items. Hence, a round
+/// neither allocates nor calls anything indirectly. Statistics per round are
+/// only recorded on request.
+class MonkeySimulator {
+public:
+  explicit MonkeySimulator(const std::vector<Monkey> &monkeys)
+      : num_monkeys_(monkeys.size()), inspected_(monkeys.size(), 0) {
+    for (const auto &monkey : monkeys) {
+      auto product = uint128_t{modulo_} * monkey.testarg;
+      if (product > std::numeric_limits<std::uint64_t>::max()) {
+        throw std::overflow_error(
+            "The product of all test divisors doesn't fit in 64 bit");
+      }
+      modulo_ = static_cast<std::uint64_t>(product);
+    }
+
+    std::size_t num_items = 0;
+    for (const auto &monkey : monkeys) {
+      num_items += monkey.items.size();
+
+      auto [opcode, operand] = std::visit(
+          overloaded{[&](Plus) {
+                       // old + old is the same as old * 2
+                       return monkey.oparg.has_value()
+                                  ? std::pair{OpCode::Add, *monkey.oparg}
+                                  : std::pair{OpCode::Multiply, uint128_t{2}};
+                     },
+                     [&](Multiplies) {
+                       return monkey.oparg.has_value()
+                                  ? std::pair{OpCode::Multiply, *monkey.oparg}
+                                  : std::pair{OpCode::Square, uint128_t{0}};
+                     }},
+          monkey.opKind);
+
+      opcode_.push_back(opcode);
+      // Only the remainder of the operand matters
+      operand_.push_back(static_cast<std::uint64_t>(operand % modulo_));
+      divisor_.push_back(static_cast<std::uint64_t>(monkey.testarg));
+      if_true_.push_back(static_cast<std::uint32_t>(monkey.throw_to_if_true));
+      if_false_.push_back(static_cast<std::uint32_t>(monkey.throw_to_if_false));
     }
-    simulate_round(monkeys, supermodulo);
-
-    if (round == 20 || round % 1000 == 0) {
-      fmt::print(
-          "After round {}, the monkeys are holding items with these worry "
-          "levels:\n",
-          round);
-      for (auto [i, monkey] : monkeys | ranges::views::enumerate) {
-        fmt::print("Monkey {}: {}\n", i, monkey.items);
+
+    capacity_ = std::bit_ceil(std::max<std::size_t>(num_items, 1));
+    items_.resize(num_monkeys_ * capacity_);
+    head_.resize(num_monkeys_, 0);
+    tail_.resize(num_monkeys_, 0);
+
+    for (std::size_t m = 0; m < num_monkeys_; ++m) {
+      for (auto item : monkeys[m].items) {
+        push(m, static_cast<std::uint64_t>(item % modulo_));
       }
     }
+
+    reduce_ = FastMod(modulo_);
+    for (auto divisor : divisor_) {
+      divisible_.push_back(divisibility_constant(divisor));
+    }
+    thrown_true_.resize(capacity_);
+    thrown_false_.resize(capacity_);
   }
 
-  auto top = top2(monkeys);
-  fmt::print("monkey business: {}\n", top.first * top.second);
+  void simulate(std::size_t rounds, bool record_rounds = false) {
+    if (record_rounds) {
+      per_round_.reserve(per_round_.size() + rounds * num_monkeys_);
+    }
+
+    for ([[maybe_unused]] auto round : ranges::views::ints(0ul, rounds)) {
+      for (std::size_t m = 0; m < num_monkeys_; ++m) {
+        auto count = tail_[m] - head_[m];
+        inspected_[m] += count;
+        if (record_rounds) {
+          per_round_.push_back(count);
+        }
+
+        for (; head_[m] != tail_[m]; ++head_[m]) {
+          auto level = apply(m, items_[m * capacity_ + (head_[m] & mask())]);
+          push(level % divisor_[m] == 0 ? if_true_[m] : if_false_[m], level);
+        }
+      }
+    }
+  }
+
+  /// Same result as simulate, but each monkey handles all of its items as one
+  /// batch. The operation is selected once per batch, the remainders are
+  /// computed with precomputed reciprocals instead of divisions, and the items
+  /// are partitioned into the items thrown to either target with vector
+  /// compares and shuffles, which are then appended in bulk. The Barrett and
+  /// Lemire constants assume that the worry levels, operands and divisors are
+  /// below 2^32, so that the results of the operations fit in 64 bit. This
+  /// holds if the product of the divisors does, otherwise it falls back to
+  /// simulate, which works on 128-bit products.
+  void simulate_batched(std::size_t rounds) {
+    // Levels and operands are below modulo_
+    if (modulo_ > std::numeric_limits<std::uint32_t>::max()) {
+      simulate(rounds);
+      return;
+    }
+
+    for ([[maybe_unused]] auto round : ranges::views::ints(0ul, rounds)) {
+      for (std::size_t m = 0; m < num_monkeys_; ++m) {
+        auto count = tail_[m] - head_[m];
+        inspected_[m] += count;
+
+        // The items wrap around the end of the ring buffer at most once
+        auto *items = &items_[m * capacity_];
+        auto first = head_[m] & mask();
+        auto before_wrap = std::min(count, capacity_ - first);
+
+        std::size_t num_true = 0;
+        std::size_t num_false = 0;
+        inspect_batch(m, items + first, before_wrap, num_true, num_false);
+        inspect_batch(m, items, count - before_wrap, num_true, num_false);
+        head_[m] = tail_[m];
+
+        push_batch(if_true_[m], thrown_true_.data(), num_true);
+        push_batch(if_false_[m], thrown_false_.data(), num_false);
+      }
+    }
+  }
+
+  /// Same result as simulate, but every item is simulated on its own. The path
+  /// of an item only depends on its own worry level, and an item thrown to a
+  /// later monkey is inspected again in the same round. So the state of an item
+  /// at the start of a round is its monkey and worry level, and as there are
+  /// finitely many of them, the states eventually repeat. Once the cycle is
+  /// found, the inspections of all full cycles are added at once. Items are
+  /// distributed over multiple threads.
+  void simulate_items(
+      std::size_t rounds,
+      std::size_t num_threads = std::thread::hardware_concurrency()) {
+    std::vector<ItemState> items;
+    for (std::uint32_t m = 0; m < num_monkeys_; ++m) {
+      for (; head_[m] != tail_[m]; ++head_[m]) {
+        items.push_back({m, items_[m * capacity_ + (head_[m] & mask())]});
+      }
+    }
+
+    num_threads = std::clamp<std::size_t>(
+        num_threads, 1, std::max<std::size_t>(items.size(), 1));
+    std::vector<std::vector<std::uint64_t>> counts(
+        num_threads, std::vector<std::uint64_t>(num_monkeys_, 0));
+
+    std::atomic<std::size_t> next = 0;
+    auto worker = [&](std::size_t t) {
+      for (auto i = next++; i < items.size(); i = next++) {
+        items[i] = simulate_item(items[i], rounds, counts[t]);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back(worker, t);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    for (const auto &c : counts) {
+      for (std::size_t m = 0; m < num_monkeys_; ++m) {
+        inspected_[m] += c[m];
+      }
+    }
+    for (auto item : items) {
+      push(item.monkey, item.level);
+    }
+  }
+
+  /// Number of inspected items per monkey
+  const std::vector<std::uint64_t> &inspected() const { return inspected_; }
+
+  /// Number of inspected items per monkey for every recorded round, one row of
+  /// all monkeys per round
+  const std::vector<std::uint64_t> &inspected_per_round() const {
+    return per_round_;
+  }
+
+  std::uint64_t monkey_business() const {
+    auto counts = inspected_;
+    ranges::sort(counts, std::greater{});
+    return counts.size() < 2 ? 0 : counts[0] * counts[1];
+  }
+
+private:
+  struct ItemState {
+    std::uint32_t monkey;
+    std::uint64_t level;
+
+    bool operator==(const ItemState &) const = default;
+  };
+
+  std::size_t mask() const { return capacity_ - 1; }
+
+  /// Simulate one round of a single item, adding its inspections to counts if
+  /// given
+  ItemState item_round(ItemState item, std::uint64_t *counts) const {
+    while (true) {
+      auto m = item.monkey;
+      if (counts != nullptr) {
+        ++counts[m];
+      }
+
+      auto level = apply(m, item.level);
+      auto target = level % divisor_[m] == 0 ? if_true_[m] : if_false_[m];
+      item = {target, level};
+
+      // Monkeys with a lower index already had their turn
+      if (target <= m) {
+        return item;
+      }
+    }
+  }
+
+  /// Simulate the given number of rounds of one item. The cycle is found with
+  /// Brent's algorithm, if it's not found within the number of rounds, the
+  /// rounds are simulated directly.
+  ItemState simulate_item(ItemState start, std::size_t rounds,
+                          std::vector<std::uint64_t> &counts) const {
+    auto run = [&](ItemState item, std::size_t n, std::uint64_t *c) {
+      for (std::size_t i = 0; i < n; ++i) {
+        item = item_round(item, c);
+      }
+      return item;
+    };
+
+    // Length of the cycle
+    std::size_t power = 1;
+    std::size_t lambda = 1;
+    std::size_t steps = 1;
+    auto tortoise = start;
+    auto hare = item_round(start, nullptr);
+    while (tortoise != hare) {
+      if (steps > rounds) {
+        return run(start, rounds, counts.data());
+      }
+      if (power == lambda) {
+        tortoise = hare;
+        power *= 2;
+        lambda = 0;
+      }
+      hare = item_round(hare, nullptr);
+      ++lambda;
+      ++steps;
+    }
+
+    // Number of rounds before the cycle starts
+    std::size_t mu = 0;
+    tortoise = start;
+    hare = run(start, lambda, nullptr);
+    while (tortoise != hare) {
+      tortoise = item_round(tortoise, nullptr);
+      hare = item_round(hare, nullptr);
+      ++mu;
+    }
+
+    if (rounds <= mu + lambda) {
+      return run(start, rounds, counts.data());
+    }
+
+    auto item = run(start, mu, counts.data());
+
+    std::vector<std::uint64_t> cycle(num_monkeys_, 0);
+    run(item, lambda, cycle.data());
+
+    auto full_cycles = (rounds - mu) / lambda;
+    for (std::size_t m = 0; m < num_monkeys_; ++m) {
+      counts[m] += full_cycles * cycle[m];
+    }
+
+    return run(item, (rounds - mu) % lambda, counts.data());
+  }
+
+  std::uint64_t apply(std::size_t m, std::uint64_t old) const {
+    // The levels and operands are below modulo_, so the results fit in 64 bit
+    // if modulo_ does in 32 bit. Only larger products need the much slower
+    // 128-bit arithmetic
+    if (modulo_ <= std::numeric_limits<std::uint32_t>::max()) {
+      return apply<std::uint64_t>(m, old);
+    }
+    return apply<uint128_t>(m, old);
+  }
+
+  template <typename T>
+  std::uint64_t apply(std::size_t m, std::uint64_t old) const {
+    T level = old;
+    switch (opcode_[m]) {
+    case OpCode::Add:
+      level += operand_[m];
+      break;
+    case OpCode::Multiply:
+      level *= operand_[m];
+      break;
+    case OpCode::Square:
+      level *= level;
+      break;
+    }
+    return static_cast<std::uint64_t>(level % modulo_);
+  }
+
+  void push(std::size_t m, std::uint64_t level) {
+    items_[m * capacity_ + (tail_[m]++ & mask())] = level;
+  }
+
+  void push_batch(std::size_t m, const std::uint64_t *levels, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      push(m, levels[i]);
+    }
+  }
+
+  /// Apply the operation of monkey m to n consecutive items and add them to
+  /// the thrown items. Four items at a time go through the vector kernel:
+  /// each lane is reduced and tested, and the lanes for either target are
+  /// moved to the front with a shuffle and stored as a whole. Only the count
+  /// advances by the number of matching lanes, the rest is overwritten later.
+  /// This never writes past the buffers, as at most as many items as were
+  /// processed before the current four are stored in either of them. The
+  /// remaining items take the same path one at a time.
+  void inspect_batch(std::size_t m, const std::uint64_t *levels,
+                     std::size_t n, std::size_t &num_true,
+                     std::size_t &num_false) {
+    auto divisible = divisible_[m];
+
+    auto run = [&](auto op) {
+      std::size_t i = 0;
+      for (; i + 4 <= n; i += 4) {
+        u64x4 level;
+        std::memcpy(&level, levels + i, sizeof(level));
+        op(level);
+        reduce_.reduce(level);
+
+        auto mask = divisible_lanes(level, divisible);
+        auto to_true = __builtin_shuffle(level, compress_table[mask]);
+        auto to_false = __builtin_shuffle(level, compress_table[~mask & 0xF]);
+        std::memcpy(&thrown_true_[num_true], &to_true, sizeof(to_true));
+        std::memcpy(&thrown_false_[num_false], &to_false, sizeof(to_false));
+
+        auto matches = static_cast<std::size_t>(std::popcount(mask));
+        num_true += matches;
+        num_false += 4 - matches;
+      }
+
+      for (; i < n; ++i) {
+        auto level = levels[i];
+        op(level);
+        level = reduce_(level);
+        bool is_true = is_divisible(level, divisible);
+        thrown_true_[num_true] = level;
+        thrown_false_[num_false] = level;
+        num_true += is_true;
+        num_false += !is_true;
+      }
+    };
+
+    auto operand = operand_[m];
+    switch (opcode_[m]) {
+    case OpCode::Add:
+      run([operand](auto &level) { level += operand; });
+      break;
+    case OpCode::Multiply:
+      run([operand](auto &level) { level *= operand; });
+      break;
+    case OpCode::Square:
+      run([](auto &level) { level *= level; });
+      break;
+    }
+  }
+
+  std::size_t num_monkeys_;
+
+  std::vector<OpCode> opcode_;
+  std::vector<std::uint64_t> operand_;
+  std::vector<std::uint64_t> divisor_;
+  std::vector<std::uint32_t> if_true_;
+  std::vector<std::uint32_t> if_false_;
+  std::uint64_t modulo_ = 1;
+
+  // Reciprocals and thrown items of simulate_batched
+  FastMod reduce_;
+  std::vector<std::uint64_t> divisible_;
+  std::vector<std::uint64_t> thrown_true_;
+  std::vector<std::uint64_t> thrown_false_;
+
+  // Ring buffers of all monkeys, with capacity_ entries each
+  std::size_t capacity_;
+  std::vector<std::uint64_t> items_;
+  std::vector<std::size_t> head_;
+  std::vector<std::size_t> tail_;
+
+  std::vector<std::uint64_t> inspected_;
+  std::vector<std::uint64_t> per_round_;
+};
+
+void part2(const std::vector<Monkey> &monkeys) {
+  MonkeySimulator simulator(monkeys);
+  simulator.simulate(10'000);
+
+  fmt::print("Inspected items: {}\n", simulator.inspected());
+  fmt::print("monkey business: {}\n", simulator.monkey_business());
+
+  MonkeySimulator per_item(monkeys);
+  per_item.simulate_items(10'000);
+  fmt::print("monkey business (per item): {}\n", per_item.monkey_business());
+
+  MonkeySimulator batched(monkeys);
+  batched.simulate_batched(10'000);
+  fmt::print("monkey business (batched): {}\n", batched.monkey_business());
 }
 
 int main() {
@@ -1,11 +1,7 @@
-#include <charconv>
-#include <functional>
+#include <cstdint>
 #include <iostream>
 #include <optional>
-#include <queue>
 #include <string>
-#include <string_view>
-#include <variant>
 #include <vector>
 
 #define FMT_HEADER_ONLY = 1
@@ -15,170 +11,124 @@
 #include <range/v3/all.hpp>
 
 #include "input.hpp"
-#include "overloaded.hpp"
-
-// Assume c to be 'a' - 'z'
-int to_int(char c) { return static_cast<int>(c - 'a') + 1; }
-
-std::vector<std::vector<int>> parse_input(const std::vector<std::string> &in) {
-  return in | ranges::views::transform([](auto line) {
-           return line | ranges::views::transform([](auto c) {
-                    if (c == 'S') {
-                      return 1;
-                    } else if (c == 'E') {
-                      return 26;
-                    } else {
-                      return to_int(c);
-                    }
-                  }) |
-                  ranges::to<std::vector>;
-         }) |
-         ranges::to<std::vector>;
-}
 
-std::pair<int, int> find(const std::vector<std::string> &map, char c) {
-  for (auto [i, l] : map | ranges::views::enumerate) {
-    auto it = ranges::find(l, c);
-    if (it != ranges::end(l)) {
-      return {i, ranges::distance(ranges::begin(l), it)};
+using Cell = std::uint32_t;
+
+/// Heights 0 ('a') to 25 ('z') in row-major order
+struct HeightMap {
+  std::size_t rows;
+  std::size_t cols;
+  std::vector<std::uint8_t> heights;
+  Cell start;
+  Cell end;
+};
+
+HeightMap parse_input(const std::vector<std::string> &in) {
+  HeightMap map{0, 0, {}, 0, 0};
+  for (const auto &line : in) {
+    if (line.empty()) {
+      continue;
+    }
+    map.cols = line.size();
+    ++map.rows;
+
+    for (auto c : line) {
+      auto cell = static_cast<Cell>(map.heights.size());
+      if (c == 'S') {
+        map.start = cell;
+        c = 'a';
+      } else if (c == 'E') {
+        map.end = cell;
+        c = 'z';
+      }
+      map.heights.push_back(static_cast<std::uint8_t>(c - 'a'));
     }
   }
-  return {-1, -1};
-}
-
-std::pair<int, int> find_start(const std::vector<std::string> &map) {
-  return find(map, 'S');
+  return map;
 }
 
-std::pair<int, int> find_end(const std::vector<std::string> &map) {
-  return find(map, 'E');
-}
-
-using Index = std::pair<int, int>;
-using Something = std::pair<Index, int>;
-
-constexpr int infinity = 100'000'000;
-
-auto init_dijkstra(const std::vector<std::vector<int>> &map,
-                   bool part2 = false) {
-  int rows = map.size();
-  int cols = map[0].size();
-
-  auto coords = ranges::views::cartesian_product(ranges::views::iota(0, rows),
-                                                 ranges::views::iota(0, cols));
-  std::map<std::pair<int, int>, int> distances;
+/// Breadth first search from source, moving from a cell to a neighbour if
+/// can_step(from_height, to_height) allows it. All steps have the same cost,
+/// so the cells leave the FIFO queue in order of their distance, and the
+/// search stops at the first cell for which is_target(cell) holds. Every cell
+/// is queued at most once, which makes a flat array of all cells a queue that
+/// never has to wrap around. Returns std::nullopt if no target is reachable.
+std::optional<std::int32_t> shortest_path(const HeightMap &map, Cell source,
+                                          auto can_step, auto is_target) {
+  constexpr std::int32_t unvisited = -1;
+
+  auto num_cells = map.rows * map.cols;
+  std::vector<std::int32_t> distance(num_cells, unvisited);
+  std::vector<Cell> queue(num_cells);
+  std::size_t head = 0;
+  std::size_t tail = 0;
+
+  distance[source] = 0;
+  queue[tail++] = source;
+
+  while (head != tail) {
+    auto cell = queue[head++];
+    if (is_target(cell)) {
+      return distance[cell];
+    }
 
-  auto cmp = [](auto left, auto right) { return left.second > right.second; };
-  std::priority_queue<Something, std::vector<Something>, decltype(cmp)>
-      unvisited(cmp);
+    auto height = map.heights[cell];
+    auto visit = [&](Cell next) {
+      if (distance[next] == unvisited && can_step(height, map.heights[next])) {
+        distance[next] = distance[cell] + 1;
+        queue[tail++] = next;
+      }
+    };
 
-  for (auto coord : coords) {
-    auto pair = std::make_pair(std::get<0>(coord), std::get<1>(coord));
-    if (part2 && map[pair.first][pair.second] == 1) {
-      distances.emplace(pair, 0);
-      unvisited.emplace(pair, 0);
-    } else {
-      distances.emplace(pair, infinity);
+    auto col = cell % map.cols;
+    if (cell >= map.cols) {
+      visit(cell - map.cols);
+    }
+    if (cell + map.cols < num_cells) {
+      visit(cell + map.cols);
+    }
+    if (col != 0) {
+      visit(cell - 1);
+    }
+    if (col + 1 != map.cols) {
+      visit(cell + 1);
     }
   }
 
-  return std::make_pair(unvisited, distances);
+  return std::nullopt;
 }
 
-int dijkstra(const std::vector<std::vector<int>> &map, Index end,
-             std::optional<Index> start = {}) {
-  auto in_bounds = [&](std::pair<int, int> idx) {
-    int rows = map.size();
-    int cols = map[0].size();
-
-    return idx.first >= 0 && idx.first < rows && idx.second >= 0 &&
-           idx.second < cols;
-  };
-
-  auto tmp = init_dijkstra(map, !start.has_value());
-  auto unvisited = tmp.first;
-  auto distances = tmp.second;
+// The destination may be at most one higher than the current position
+bool can_climb(std::uint8_t from, std::uint8_t to) { return to <= from + 1; }
 
-  if (start.has_value()) {
-    distances[*start] = 0;
+void print_distance(std::optional<std::int32_t> distance) {
+  if (distance.has_value()) {
+    fmt::print("Distance to end: {}\n", *distance);
+  } else {
+    fmt::print("The end is not reachable\n");
   }
-
-  unvisited.emplace(*start, distances[*start]);
-
-  std::map<std::pair<int, int>, std::pair<int, int>> previous;
-
-  auto update = [&map, &unvisited, &distances, &previous,
-                 in_bounds](auto v, auto u, auto distance) {
-    if (in_bounds(v)) {
-      auto vheight = map[v.first][v.second];
-      auto uheight = map[u.first][u.second];
-      auto new_distance = distance + 1;
-
-      if (vheight <= uheight + 1) {
-        // If we haven't been there yet, visit it next
-        if (distances[v] == infinity) {
-          unvisited.emplace(v, new_distance);
-        }
-
-        // Update, if the new distance to v is lower from u, than the previous
-        // one
-        if (new_distance < distances[v]) {
-          distances[v] = new_distance;
-          previous[v] = u;
-        }
-      }
-    }
-  };
-
-  while (!unvisited.empty()) {
-    auto u = unvisited.top();
-    unvisited.pop();
-
-    // Visit neighbours of u, this could be nicer, but what ever
-    auto v = u.first;
-    ++v.second;
-    update(v, u.first, u.second);
-
-    v = u.first;
-    --v.second;
-    update(v, u.first, u.second);
-
-    v = u.first;
-    ++v.first;
-    update(v, u.first, u.second);
-
-    v = u.first;
-    --v.first;
-    update(v, u.first, u.second);
-  }
-
-  return distances[end];
 }
 
-void part1(const std::vector<std::string> &in) {
-  auto map = parse_input(in);
-
-  auto start = find_start(in);
-  auto end = find_end(in);
-
-  auto shortest_path = dijkstra(map, end, start);
-  fmt::print("Distance to end: {}\n", shortest_path);
+void part1(const HeightMap &map) {
+  print_distance(shortest_path(map, map.start, can_climb,
+                               [&](Cell cell) { return cell == map.end; }));
 }
 
-void part2(const std::vector<std::string> &in) {
-  auto map = parse_input(in);
-
-  auto end = find_end(in);
-
-  auto shortest_path = dijkstra(map, end);
-  fmt::print("Distance to end: {}\n", shortest_path);
+void part2(const HeightMap &map) {
+  // Walk backwards from the end, the first cell at height 'a' is the best
+  // start of all of them
+  print_distance(shortest_path(
+      map, map.end,
+      [](std::uint8_t from, std::uint8_t to) { return can_climb(to, from); },
+      [&](Cell cell) { return map.heights[cell] == 0; }));
 }
 
 int main() {
   auto in = input();
+  auto map = parse_input(in);
 
-  part1(in);
-  part2(in);
+  part1(map);
+  part2(map);
 
   return 0;
 }